@@ -57,6 +57,7 @@
 
 #include <linux/io.h>	// virt_to_phys
 #include <linux/hrtimer.h>
+#include <linux/timex.h>	// get_cycles()
 
 #define printf(fmt, arg...)	printk(KERN_ERR fmt, ##arg)
 #define KASSERT(a, b)		BUG_ON(!(a))
@@ -173,6 +174,7 @@ struct thread;
 #define NM_ATOMIC_INC(p)                atomic_inc(p)
 #define NM_ATOMIC_READ_AND_CLEAR(p)     atomic_xchg(p, 0)
 #define NM_ATOMIC_READ(p)               atomic_read(p)
+#define NM_ATOMIC_ADD64(p, v)           atomic64_add((v), (atomic64_t *)(p))
 
 
 // XXX maybe implement it as a proper function somewhere
@@ -191,6 +193,7 @@ struct thread;
 #define m_freem(m)		dev_kfree_skb_any(m)	// free a sk_buff
 
 #define GET_MBUF_REFCNT(m)	NM_ATOMIC_READ(&((m)->users))
+#define MBUF_SHARED(m)		skb_cloned(m)	/* a clone has the data */
 #define netmap_get_mbuf(size)	alloc_skb(size, GFP_ATOMIC)
 /*
  * on tx we force skb->queue_mapping = ring_nr,
@@ -200,6 +203,8 @@ struct thread;
 #define MBUF_TXQ(m)		skb_get_queue_mapping(m)
 #define MBUF_RXQ(m)		(skb_rx_queue_recorded(m) ? skb_get_rx_queue(m) : 0)
 #define SET_MBUF_DESTRUCTOR(m, f) m->destructor = (void *)&f
+/* only looked at by the stack for SKBTX_DEV_ZEROCOPY buffers */
+#define MBUF_DESTRUCTOR_ARG(m)	(skb_shinfo(m)->destructor_arg)
 
 /* Magic number for sk_buff.priority field, used to take decisions in
  * generic_ndo_start_xmit() and in linux_generic_rx_handler().
@@ -215,6 +220,7 @@ struct thread;
 #define m_copydata(m, o, l, b)          skb_copy_bits(m, o, b, l)
 
 #define copyin(_from, _to, _len)	copy_from_user(_to, _from, _len)
+#define copyout(_from, _to, _len)	copy_to_user(_to, _from, _len)
 
 /*
  * struct ifnet is remapped into struct net_device on linux.
@@ -244,6 +250,12 @@ void if_rele(struct net_device *ifp);
 /* hook to send from user space */
 netdev_tx_t linux_netmap_start_xmit(struct sk_buff *, struct net_device *);
 
+/* classic bpf for the monitor filters, see netmap_linux.c */
+struct sock_filter;
+#define nm_bpf_insn	sock_filter
+int nm_bpf_validate(const struct sock_filter *, int);
+u_int nm_bpf_filter(const struct sock_filter *, u_char *, u_int, u_int);
+
 /* prevent ring params change while in netmap mode */
 int linux_netmap_set_ringparam(struct net_device *, struct ethtool_ringparam *);
 #ifdef NETMAP_LINUX_HAVE_SET_CHANNELS
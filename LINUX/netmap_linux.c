@@ -34,6 +34,8 @@
 
 #include "netmap_linux_config.h"
 
+#include <linux/filter.h>	/* struct sock_filter, BPF_* */
+
 #ifdef NETMAP_LINUX_HAVE_IOMMU
 #include <linux/iommu.h>
 
@@ -126,6 +128,8 @@ uint16_t nm_csum_fold(rawsum_t cur_sum)
  *   until the timer expires;
  * - when the timer expires and there are pending packets,
  *   a notification is sent up and the timer is restarted.
+ * The timer period is recomputed by generic_mit_adapt() at
+ * each expiration.
  */
 NETMAP_LINUX_TIMER_RTYPE
 generic_timer_handler(struct hrtimer *t)
@@ -143,6 +147,7 @@ generic_timer_handler(struct hrtimer *t)
      * a notification.
      */
     mit->mit_pending = 0;
+    generic_mit_adapt(mit);
     /* below is a variation of netmap_generic_irq  XXX revise */
     if (nm_netmap_on(mit->mit_na)) {
         netmap_common_irq(mit->mit_na->ifp, mit->mit_ring_idx, &work_done);
@@ -162,17 +167,19 @@ void netmap_mitigation_init(struct nm_generic_mit *mit, int idx,
     mit->mit_pending = 0;
     mit->mit_ring_idx = idx;
     mit->mit_na = na;
+    mit->mit_interval = netmap_generic_mit;
+    mit->mit_count = 0;
 }
 
 
 void netmap_mitigation_start(struct nm_generic_mit *mit)
 {
-    hrtimer_start(&mit->mit_timer, ktime_set(0, netmap_generic_mit), HRTIMER_MODE_REL);
+    hrtimer_start(&mit->mit_timer, ktime_set(0, mit->mit_interval), HRTIMER_MODE_REL);
 }
 
 void netmap_mitigation_restart(struct nm_generic_mit *mit)
 {
-    hrtimer_forward_now(&mit->mit_timer, ktime_set(0, netmap_generic_mit));
+    hrtimer_forward_now(&mit->mit_timer, ktime_set(0, mit->mit_interval));
 }
 
 int netmap_mitigation_active(struct nm_generic_mit *mit)
@@ -239,7 +246,6 @@ netmap_catch_rx(struct netmap_adapter *na, int intercept)
     return 0;
 #else /* HAVE_RX_REGISTER */
     struct ifnet *ifp = na->ifp;
-
     if (intercept) {
         return -netdev_rx_handler_register(na->ifp,
                 &linux_generic_rx_handler, na);
@@ -317,27 +323,266 @@ void netmap_catch_tx(struct netmap_generic_adapter *gna, int enable)
     }
 }
 
-/* Transmit routine used by generic_netmap_txsync(). Returns 0 on success
-   and -1 on error (which may be packet drops or other errors). */
-int generic_xmit_frame(struct ifnet *ifp, struct mbuf *m,
-	void *addr, u_int len, u_int ring_nr)
+/* Lock the tx queue ring_nr for a batch of GENERIC_XMIT_DIRECT
+ * transmissions, as the qdisc layer does in sch_direct_xmit().
+ */
+void generic_xmit_lock(struct ifnet *ifp, u_int ring_nr)
 {
-    netdev_tx_t ret;
+    struct netdev_queue *txq = netdev_get_tx_queue(ifp, ring_nr);
+
+    local_bh_disable();
+    HARD_TX_LOCK(ifp, txq, smp_processor_id());
+}
+
+void generic_xmit_unlock(struct ifnet *ifp, u_int ring_nr)
+{
+    struct netdev_queue *txq = netdev_get_tx_queue(ifp, ring_nr);
+
+    HARD_TX_UNLOCK(ifp, txq);
+    local_bh_enable();
+}
+
+/* Consumed rx sk_buffs are freed in batches with bottom halves
+ * disabled, so that napi_consume_skb() can put them in the per-cpu
+ * cache that napi_alloc_skb() and napi_build_skb() in the drivers
+ * allocate from. Pages coming from a page_pool are returned to the
+ * pool when the sk_buff is freed.
+ */
+#define GENERIC_RX_RECYCLE_BATCH	64
+
+void generic_rx_recycle(struct mbq *q)
+{
+    struct mbuf *m;
+    u_int n;
+
+    while (mbq_peek(q)) {
+        local_bh_disable();
+        for (n = 0; n < GENERIC_RX_RECYCLE_BATCH &&
+                (m = mbq_dequeue(q)) != NULL; n++) {
+#ifdef NETMAP_LINUX_HAVE_NAPI_CONSUME_SKB
+            napi_consume_skb(m, 1);
+#else
+            consume_skb(m);
+#endif
+        }
+        local_bh_enable();
+    }
+}
+
+/* Frames up to this size are copied, larger ones have the first
+ * GENERIC_TX_COPYBREAK bytes copied (the driver may want the headers
+ * in the linear part) and the rest attached as page fragments.
+ */
+#define GENERIC_TX_COPYBREAK	128
+
+/* Bring a tx_pool mbuf back to an empty linear sk_buff,
+ * releasing the netmap pages attached by a previous transmission.
+ * The mbuf must not be cloned, or the clone would lose its data.
+ */
+static void generic_skb_reset(struct mbuf *m)
+{
+    int i;
+
+    for (i = 0; i < skb_shinfo(m)->nr_frags; i++)
+        skb_frag_unref(m, i);
+    skb_shinfo(m)->nr_frags = 0;
+    m->truesize -= m->data_len;
+    m->len -= m->data_len;
+    m->data_len = 0;
 
-    /* Empty the sk_buff. */
     if (unlikely(skb_headroom(m)))
 	skb_push(m, skb_headroom(m));
     skb_trim(m, 0);
+}
+
+/* Append len bytes at addr to m, copying at most *copy bytes
+ * and attaching the rest as page fragments of the netmap buffer.
+ * The netmap memory comes from split pages, so each page has its
+ * own reference count.
+ */
+static void generic_skb_append(struct mbuf *m, void *addr, u_int len,
+	u_int *copy)
+{
+    u_int l = min(len, *copy);
+
+    if (l) {
+        memcpy(skb_put(m, l), addr, l);
+        *copy -= l;
+        addr += l;
+        len -= l;
+    }
+    while (len) {
+        struct page *page = virt_to_page(addr);
+        u_int off = offset_in_page(addr);
+
+        l = min_t(u_int, len, PAGE_SIZE - off);
+        get_page(page);
+        skb_fill_page_desc(m, skb_shinfo(m)->nr_frags, page, off, l);
+        m->len += l;
+        m->data_len += l;
+        m->truesize += l;
+        addr += l;
+        len -= l;
+    }
+}
+
+/* The netmap pages attached to an sk_buff are only protected by
+ * get_page(), with no ubuf_info, so nothing copies them if the frame
+ * is delivered locally (veth, loopback, bridges towards a socket):
+ * the fragments may be coalesced into an sk_buff sitting in a socket
+ * queue while the slot goes back to userspace. Attach them only on
+ * devices backed by hardware, whose driver sends them to the wire.
+ */
+static inline int generic_xmit_zcopy_ok(struct ifnet *ifp)
+{
+    return (ifp->features & NETIF_F_SG) && ifp->dev.parent != NULL &&
+            !(ifp->flags & IFF_LOOPBACK);
+}
+
+/* Whether the netmap buffers of a frame of tot bytes in nfrags slots
+ * are attached to the sk_buff rather than copied.
+ */
+static inline int generic_xmit_zcopy(struct ifnet *ifp,
+	struct netmap_adapter *na, u_int tot, u_int nfrags, int flags)
+{
+    /* dev_queue_xmit() clones the frames for the packet taps, and
+     * a clone can outlive the completion of the transmission, so the
+     * netmap buffers are only attached on the direct path.
+     */
+    return (flags & GENERIC_XMIT_DIRECT) && generic_xmit_zcopy_ok(ifp) &&
+            tot > GENERIC_TX_COPYBREAK &&
+            nfrags * (NETMAP_BUF_SIZE(na) / PAGE_SIZE + 2) <= MAX_SKB_FRAGS;
+}
+
+/* Used by generic_netmap_txsync() before passing xmit_more for the
+   previous frame. Returns 1 if generic_xmit_frame() cannot fail on
+   the frame in the nfrags slots of kring starting at first, except
+   for the driver stopping the queue (drivers ring the doorbell when
+   they stop the queue). A clone still sharing the sk_buff of the
+   frame is replaced here, so that no allocation is left to do.
+   Otherwise the frame that fails would be the one expected to ring
+   the doorbell for the previous ones. */
+int generic_xmit_ready(struct ifnet *ifp, struct netmap_kring *kring,
+	u_int first, u_int nfrags, int flags)
+{
+    struct netmap_adapter *na = kring->na;
+    struct netmap_ring *ring = kring->ring;
+    u_int const lim = kring->nkr_num_slots - 1;
+    struct mbuf *m = kring->tx_pool[first];
+    u_int nm_i, i, tot = 0;
+
+    if (unlikely(m == NULL || GET_MBUF_REFCNT(m) != 1))
+        return 0;
+    if (unlikely(skb_cloned(m))) {
+        struct mbuf *n = netmap_get_mbuf(NETMAP_BUF_SIZE(na));
+
+        if (unlikely(n == NULL))
+            return 0;
+        m_freem(m);
+        kring->tx_pool[first] = m = n;
+    }
+    for (nm_i = first, i = 0; i < nfrags; i++, nm_i = nm_next(nm_i, lim)) {
+        struct netmap_slot *slot = &ring->slot[nm_i];
+
+        if (slot->flags & NS_INDIRECT)
+            return 0; /* the copyin() may fail */
+        tot += slot->len;
+    }
+    /* the room of the empty sk_buff, see generic_skb_reset() */
+    return generic_xmit_zcopy(ifp, na, tot, nfrags, flags) ||
+            tot <= skb_end_pointer(m) - m->head;
+}
+
+/* Transmit routine used by generic_netmap_txsync(). Returns 0 on success,
+   GENERIC_XMIT_DROP if the frame must be dropped, and -1 on other
+   errors (the caller retries later).
+   The frame is in the nfrags slots of kring starting at first.
+   If the device supports scatter-gather the netmap buffers are
+   attached to the sk_buff instead of being copied.
+   With GENERIC_XMIT_DIRECT the frame goes straight to the driver
+   (the caller holds the queue lock) and GENERIC_XMIT_MORE is passed
+   on as xmit_more. Otherwise we use dev_queue_xmit(). */
+int generic_xmit_frame(struct ifnet *ifp, struct mbuf *m,
+	struct netmap_kring *kring, u_int first, u_int nfrags, int flags)
+{
+    struct netmap_adapter *na = kring->na;
+    struct netmap_ring *ring = kring->ring;
+    u_int const lim = kring->nkr_num_slots - 1;
+    u_int ring_nr = kring->ring_id;
+    struct netdev_queue *txq = netdev_get_tx_queue(ifp, ring_nr);
+    u_int nm_i, i, tot = 0, copy;
+    int zcopy;
+    netdev_tx_t ret;
+
+#ifdef NETMAP_LINUX_HAVE_NETDEV_START_XMIT
+    if ((flags & GENERIC_XMIT_DIRECT) && netif_xmit_frozen_or_stopped(txq))
+#else
+    if ((flags & GENERIC_XMIT_DIRECT) && netif_tx_queue_stopped(txq))
+#endif
+        return -1; /* no room in the driver, nothing consumed */
+    /* Completions are tracked per event, an out of order one
+     * may leave the skb still referenced by the driver.
+     */
+    if (unlikely(GET_MBUF_REFCNT(m) != 1))
+        return -1;
+    /* A clone (e.g. for a packet tap) may still share the data and
+     * the fragments of m. Leave them to the clone, and replace m
+     * in the pool with a new sk_buff.
+     */
+    if (unlikely(skb_cloned(m))) {
+        struct mbuf *n = netmap_get_mbuf(NETMAP_BUF_SIZE(na));
+
+        if (unlikely(n == NULL))
+            return -1;
+        m_freem(m);
+        kring->tx_pool[first] = m = n;
+    }
 
-    /* TODO Support the slot flags (NS_MOREFRAG, NS_INDIRECT). */
-    skb_copy_to_linear_data(m, addr, len); // skb_store_bits(m, 0, addr, len);
-    skb_put(m, len);
+    /* Empty the sk_buff. */
+    generic_skb_reset(m);
+
+    for (nm_i = first, i = 0; i < nfrags; i++, nm_i = nm_next(nm_i, lim))
+        tot += ring->slot[nm_i].len;
+    zcopy = generic_xmit_zcopy(ifp, na, tot, nfrags, flags);
+    copy = zcopy ? GENERIC_TX_COPYBREAK : skb_tailroom(m);
+    if (zcopy)
+        kring->nkr_tx_zcopy = 1; /* see generic_netmap_tx_clean() */
+    if (unlikely(!zcopy && tot > copy))
+        return GENERIC_XMIT_DROP; /* does not fit in the sk_buff */
+
+    for (nm_i = first, i = 0; i < nfrags; i++, nm_i = nm_next(nm_i, lim)) {
+        struct netmap_slot *slot = &ring->slot[nm_i];
+        u_int len = slot->len;
+        void *addr = NMB(na, slot);
+
+        NM_CHECK_ADDR_LEN(na, addr, len);
+        generic_skb_append(m, addr, len, &copy);
+    }
     NM_ATOMIC_INC(&m->users);
     m->dev = ifp;
     /* Tell generic_ndo_start_xmit() to pass this mbuf to the driver. */
     m->priority = NM_MAGIC_PRIORITY_TX;
     skb_set_queue_mapping(m, ring_nr);
 
+    if (flags & GENERIC_XMIT_DIRECT) {
+#ifdef NETMAP_LINUX_HAVE_NETDEV_START_XMIT
+        ret = netdev_start_xmit(m, ifp, txq, !!(flags & GENERIC_XMIT_MORE));
+#else
+        ret = ifp->netdev_ops->ndo_start_xmit(m, ifp);
+        if (ret == NETDEV_TX_OK)
+            txq_trans_update(txq);
+#endif
+        if (likely(ret == NETDEV_TX_OK)) {
+            return 0;
+        }
+        /* The driver did not take the mbuf, drop our extra reference. */
+        m_freem(m);
+        if (unlikely(ret != NETDEV_TX_BUSY)) {
+            RD(5, "ndo_start_xmit failed: HARD ERROR %d", ret);
+        }
+        return -1;
+    }
+
     ret = dev_queue_xmit(m);
 
     if (likely(ret == NET_XMIT_SUCCESS)) {
@@ -410,6 +655,259 @@ out:
 }
 
 
+/* ####################### MONITOR FILTERS ######################## */
+
+/*
+ * Classic BPF on a flat buffer, used by the monitor filters. This is
+ * the machine of bpf_filter(9) on FreeBSD. Linux only runs classic
+ * programs on sk_buffs (after translating them), which the monitors
+ * do not have.
+ */
+#define NM_BPF_W(p, k) \
+    ((uint32_t)(p)[k] << 24 | (uint32_t)(p)[(k) + 1] << 16 | \
+     (uint32_t)(p)[(k) + 2] << 8 | (p)[(k) + 3])
+#define NM_BPF_H(p, k) ((uint32_t)(p)[k] << 8 | (p)[(k) + 1])
+
+/* return nonzero if the program of len instructions is safe to run */
+int
+nm_bpf_validate(const struct sock_filter *f, int len)
+{
+    int i;
+
+    if (len < 1 || len > BPF_MAXINSNS)
+        return 0;
+    for (i = 0; i < len; i++) {
+        const struct sock_filter *p = &f[i];
+        u_int left = len - i - 1;
+
+        switch (BPF_CLASS(p->code)) {
+        case BPF_LD:
+        case BPF_LDX:
+            if (BPF_MODE(p->code) == BPF_MEM && p->k >= BPF_MEMWORDS)
+                return 0;
+            break;
+        case BPF_ST:
+        case BPF_STX:
+            if (p->k >= BPF_MEMWORDS)
+                return 0;
+            break;
+        case BPF_ALU:
+            if ((BPF_OP(p->code) == BPF_DIV || BPF_OP(p->code) == BPF_MOD) &&
+                    BPF_SRC(p->code) == BPF_K && p->k == 0)
+                return 0;
+            break;
+        case BPF_JMP:
+            if (BPF_OP(p->code) == BPF_JA) {
+                if (p->k >= left)
+                    return 0;
+            } else if (p->jt >= left || p->jf >= left) {
+                return 0;
+            }
+            break;
+        case BPF_RET:
+        case BPF_MISC:
+            break;
+        default:
+            return 0;
+        }
+    }
+    return BPF_CLASS(f[len - 1].code) == BPF_RET;
+}
+
+/* run a validated program on the buflen bytes at p, of a frame
+ * of wirelen bytes. Return how many bytes to keep, 0 to drop it.
+ * Unknown instructions and loads out of the buffer also drop it.
+ */
+u_int
+nm_bpf_filter(const struct sock_filter *pc, u_char *p, u_int wirelen,
+        u_int buflen)
+{
+    uint32_t A = 0, X = 0, k;
+    uint32_t mem[BPF_MEMWORDS];
+
+    memset(mem, 0, sizeof(mem));
+    for (;; pc++) {
+        switch (pc->code) {
+        default:
+            return 0;
+        case BPF_RET|BPF_K:
+            return pc->k;
+        case BPF_RET|BPF_A:
+            return A;
+
+        case BPF_LD|BPF_W|BPF_ABS:
+            k = pc->k;
+            if (k > buflen || 4 > buflen - k)
+                return 0;
+            A = NM_BPF_W(p, k);
+            continue;
+        case BPF_LD|BPF_H|BPF_ABS:
+            k = pc->k;
+            if (k > buflen || 2 > buflen - k)
+                return 0;
+            A = NM_BPF_H(p, k);
+            continue;
+        case BPF_LD|BPF_B|BPF_ABS:
+            k = pc->k;
+            if (k >= buflen)
+                return 0;
+            A = p[k];
+            continue;
+        case BPF_LD|BPF_W|BPF_IND:
+            k = X + pc->k;
+            if (pc->k > buflen || X > buflen - pc->k || 4 > buflen - k)
+                return 0;
+            A = NM_BPF_W(p, k);
+            continue;
+        case BPF_LD|BPF_H|BPF_IND:
+            k = X + pc->k;
+            if (pc->k > buflen || X > buflen - pc->k || 2 > buflen - k)
+                return 0;
+            A = NM_BPF_H(p, k);
+            continue;
+        case BPF_LD|BPF_B|BPF_IND:
+            k = X + pc->k;
+            if (pc->k >= buflen || X >= buflen - pc->k)
+                return 0;
+            A = p[k];
+            continue;
+        case BPF_LDX|BPF_MSH|BPF_B:
+            k = pc->k;
+            if (k >= buflen)
+                return 0;
+            X = (p[k] & 0xf) << 2;
+            continue;
+        case BPF_LD|BPF_W|BPF_LEN:
+            A = wirelen;
+            continue;
+        case BPF_LDX|BPF_W|BPF_LEN:
+            X = wirelen;
+            continue;
+        case BPF_LD|BPF_IMM:
+            A = pc->k;
+            continue;
+        case BPF_LDX|BPF_IMM:
+            X = pc->k;
+            continue;
+        case BPF_LD|BPF_MEM:
+            A = mem[pc->k];
+            continue;
+        case BPF_LDX|BPF_MEM:
+            X = mem[pc->k];
+            continue;
+        case BPF_ST:
+            mem[pc->k] = A;
+            continue;
+        case BPF_STX:
+            mem[pc->k] = X;
+            continue;
+
+        case BPF_JMP|BPF_JA:
+            pc += pc->k;
+            continue;
+        case BPF_JMP|BPF_JGT|BPF_K:
+            pc += (A > pc->k) ? pc->jt : pc->jf;
+            continue;
+        case BPF_JMP|BPF_JGE|BPF_K:
+            pc += (A >= pc->k) ? pc->jt : pc->jf;
+            continue;
+        case BPF_JMP|BPF_JEQ|BPF_K:
+            pc += (A == pc->k) ? pc->jt : pc->jf;
+            continue;
+        case BPF_JMP|BPF_JSET|BPF_K:
+            pc += (A & pc->k) ? pc->jt : pc->jf;
+            continue;
+        case BPF_JMP|BPF_JGT|BPF_X:
+            pc += (A > X) ? pc->jt : pc->jf;
+            continue;
+        case BPF_JMP|BPF_JGE|BPF_X:
+            pc += (A >= X) ? pc->jt : pc->jf;
+            continue;
+        case BPF_JMP|BPF_JEQ|BPF_X:
+            pc += (A == X) ? pc->jt : pc->jf;
+            continue;
+        case BPF_JMP|BPF_JSET|BPF_X:
+            pc += (A & X) ? pc->jt : pc->jf;
+            continue;
+
+        case BPF_ALU|BPF_ADD|BPF_X:
+            A += X;
+            continue;
+        case BPF_ALU|BPF_SUB|BPF_X:
+            A -= X;
+            continue;
+        case BPF_ALU|BPF_MUL|BPF_X:
+            A *= X;
+            continue;
+        case BPF_ALU|BPF_DIV|BPF_X:
+            if (X == 0)
+                return 0;
+            A /= X;
+            continue;
+        case BPF_ALU|BPF_MOD|BPF_X:
+            if (X == 0)
+                return 0;
+            A %= X;
+            continue;
+        case BPF_ALU|BPF_AND|BPF_X:
+            A &= X;
+            continue;
+        case BPF_ALU|BPF_OR|BPF_X:
+            A |= X;
+            continue;
+        case BPF_ALU|BPF_XOR|BPF_X:
+            A ^= X;
+            continue;
+        case BPF_ALU|BPF_LSH|BPF_X:
+            A = (X < 32) ? A << X : 0;
+            continue;
+        case BPF_ALU|BPF_RSH|BPF_X:
+            A = (X < 32) ? A >> X : 0;
+            continue;
+        case BPF_ALU|BPF_ADD|BPF_K:
+            A += pc->k;
+            continue;
+        case BPF_ALU|BPF_SUB|BPF_K:
+            A -= pc->k;
+            continue;
+        case BPF_ALU|BPF_MUL|BPF_K:
+            A *= pc->k;
+            continue;
+        case BPF_ALU|BPF_DIV|BPF_K:
+            A /= pc->k;
+            continue;
+        case BPF_ALU|BPF_MOD|BPF_K:
+            A %= pc->k;
+            continue;
+        case BPF_ALU|BPF_AND|BPF_K:
+            A &= pc->k;
+            continue;
+        case BPF_ALU|BPF_OR|BPF_K:
+            A |= pc->k;
+            continue;
+        case BPF_ALU|BPF_XOR|BPF_K:
+            A ^= pc->k;
+            continue;
+        case BPF_ALU|BPF_LSH|BPF_K:
+            A = (pc->k < 32) ? A << pc->k : 0;
+            continue;
+        case BPF_ALU|BPF_RSH|BPF_K:
+            A = (pc->k < 32) ? A >> pc->k : 0;
+            continue;
+        case BPF_ALU|BPF_NEG:
+            A = -A;
+            continue;
+
+        case BPF_MISC|BPF_TAX:
+            X = A;
+            continue;
+        case BPF_MISC|BPF_TXA:
+            A = X;
+            continue;
+        }
+    }
+}
+
 /* ######################## FILE OPERATIONS ####################### */
 
 struct net_device *
@@ -575,6 +1073,7 @@ linux_netmap_ioctl(struct file *file, u_int cmd, u_long data /* arg */)
 	union {
 		struct nm_ifreq ifr;
 		struct nmreq nmr;
+		struct nm_syncv nv;
 	} arg;
 	size_t argsize = 0;
 
@@ -585,6 +1084,9 @@ linux_netmap_ioctl(struct file *file, u_int cmd, u_long data /* arg */)
 	case NIOCCONFIG:
 		argsize = sizeof(arg.ifr);
 		break;
+	case NIOCSYNCV:
+		argsize = sizeof(arg.nv);
+		break;
 	default:
 		argsize = sizeof(arg.nmr);
 		break;
@@ -640,6 +1142,34 @@ static struct file_operations netmap_fops = {
 };
 
 
+/* fd -> netmap priv, for NIOCSYNCV. 'td' is unused on linux. */
+int
+netmap_fd_getpriv(int fd, struct thread *td,
+	struct netmap_priv_d **priv, void **cookie)
+{
+	struct file *filp = fget(fd);
+
+	(void)td;
+	if (filp == NULL)
+		return EBADF;
+	if (filp->f_op != &netmap_fops || filp->private_data == NULL) {
+		fput(filp);
+		return EBADF;
+	}
+	*priv = (struct netmap_priv_d *)filp->private_data;
+	*cookie = filp;
+	return 0;
+}
+
+
+void
+netmap_fd_putpriv(void *cookie, struct thread *td)
+{
+	(void)td;
+	fput((struct file *)cookie);
+}
+
+
 
 #ifdef WITH_V1000
 /* ##################### V1000 BACKEND SUPPORT ##################### */
@@ -695,16 +1225,20 @@ static int netmap_backend_nm_notify(struct netmap_adapter *na,
 		kring = na->tx_rings + n_ring;
 		wake_up_interruptible_poll(&kring->si, POLLIN |
 					POLLRDNORM | POLLRDBAND);
-		if (na->tx_si_users > 0)
+		if (na->tx_si_users > 0) {
+			nm_notify_pending(na, n_ring, NR_TX);
 			wake_up_interruptible_poll(&na->tx_si, POLLIN |
 					POLLRDNORM | POLLRDBAND);
+		}
 	} else {
 		kring = na->rx_rings + n_ring;
 		wake_up_interruptible_poll(&kring->si, POLLIN |
 					POLLRDNORM | POLLRDBAND);
-		if (na->rx_si_users > 0)
+		if (na->rx_si_users > 0) {
+			nm_notify_pending(na, n_ring, NR_RX);
 			wake_up_interruptible_poll(&na->rx_si, POLLIN |
 					POLLRDNORM | POLLRDBAND);
+		}
 	}
 
 	return 0;
@@ -1182,16 +1716,20 @@ static int netmap_socket_nm_notify(struct netmap_adapter *na,
 		kring = na->tx_rings + n_ring;
 		wake_up_interruptible_poll(&kring->si, POLLIN |
 					POLLRDNORM | POLLRDBAND);
-		if (na->tx_si_users > 0)
+		if (na->tx_si_users > 0) {
+			nm_notify_pending(na, n_ring, NR_TX);
 			wake_up_interruptible_poll(&na->tx_si, POLLIN |
 					POLLRDNORM | POLLRDBAND);
+		}
 	} else {
 		kring = na->rx_rings + n_ring;
 		wake_up_interruptible_poll(&kring->si, POLLIN |
 					POLLRDNORM | POLLRDBAND);
-		if (na->rx_si_users > 0)
+		if (na->rx_si_users > 0) {
+			nm_notify_pending(na, n_ring, NR_RX);
 			wake_up_interruptible_poll(&na->rx_si, POLLIN |
 					POLLRDNORM | POLLRDBAND);
+		}
 	}
 
 	return 0;
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2015 Universita` di Pisa. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * nmlat: dump the latency histograms of a netmap port.
+ * The kernel only collects them when dev.netmap.latency is set
+ * (on linux, /sys/module/netmap_lin/parameters/latency) before
+ * the port is registered.
+ *
+ *	nmlat [-r] port ...
+ *
+ * -r clears the histograms after reading them.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <inttypes.h>	/* PRI* macros */
+#include <string.h>	/* strcmp */
+#include <fcntl.h>	/* open */
+#include <unistd.h>	/* close */
+#include <sys/ioctl.h>	/* ioctl */
+#include <sys/param.h>
+#include <sys/socket.h>	/* apple needs sockaddr */
+#include <net/if.h>	/* ifreq */
+#include <net/netmap.h>
+#include <stdlib.h>	/* exit */
+
+static const char *hist_names[NM_LAT_NUM] = {
+	[NM_LAT_TXSYNC]		= "txsync (cycles)",
+	[NM_LAT_RXSYNC]		= "rxsync (cycles)",
+	[NM_LAT_BDG_BATCH]	= "bridge batch (packets)",
+	[NM_LAT_WAKEUP]		= "notify to poll (cycles)",
+};
+
+static int
+dump_port(int fd, const char *name, uint32_t flags)
+{
+	struct nm_ifreq ifr;
+	struct nm_lat_req *req = (struct nm_lat_req *)(void *)ifr.data;
+	int h, b, last;
+
+	printf("%s\n", name);
+	for (h = 0; h < NM_LAT_NUM; h++) {
+		uint64_t tot = 0;
+
+		memset(&ifr, 0, sizeof(ifr));
+		req->nlr_cmd = NM_CFG_LATENCY;
+		req->nlr_hist = h;
+		req->nlr_flags = flags;
+		strncpy(req->nlr_name, name, sizeof(req->nlr_name) - 1);
+		if (ioctl(fd, NIOCCONFIG, &ifr) < 0) {
+			fprintf(stderr, "%s: %s\n", name, strerror(errno));
+			return -1;
+		}
+		for (b = last = 0; b < NM_LAT_BUCKETS; b++) {
+			tot += req->nlr_bucket[b];
+			if (req->nlr_bucket[b])
+				last = b;
+		}
+		printf("  %s, %" PRIu64 " samples\n", hist_names[h], tot);
+		if (tot == 0)
+			continue;
+		for (b = 0; b <= last; b++) {
+			printf("    %s%12" PRIu64 " %12" PRIu64 "\n",
+				b == NM_LAT_BUCKETS - 1 ? ">=" : "  ",
+				b == 0 ? 0 : (uint64_t)1 << b,
+				req->nlr_bucket[b]);
+		}
+	}
+	return 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: nmlat [-r] port ...\n"
+		"\t-r\tclear the histograms after reading\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint32_t flags = 0;
+	int ch, fd, i, ret = 0;
+
+	while ((ch = getopt(argc, argv, "r")) != -1) {
+		switch (ch) {
+		case 'r':
+			flags |= NM_LAT_RESET;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1)
+		usage();
+
+	fd = open("/dev/netmap", O_RDWR);
+	if (fd < 0) {
+		perror("/dev/netmap");
+		return 1;
+	}
+	for (i = 0; i < argc; i++) {
+		if (dump_port(fd, argv[i], flags))
+			ret = 1;
+	}
+	close(fd);
+	return ret;
+}
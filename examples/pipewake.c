@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2015 Universita` di Pisa. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * pipewake: measure the wakeups per packet between the two endpoints
+ * of a netmap pipe, with the wakeup suppression of the pipes enabled
+ * and disabled (dev.netmap.pipe_evidx, on linux
+ * /sys/module/netmap_lin/parameters/pipe_evidx).
+ *
+ *	pipewake [-p parent] [-n packets] [-b burst] [-P]
+ *
+ * The master endpoint of pipe 1 of the parent (default vale0:pw)
+ * writes to the slave endpoint, each from its own thread.
+ * -P runs a ping-pong instead: the master sends one packet at a time
+ * and waits for the slave to send it back.
+ * For each setting the program reports the poll() calls per packet
+ * of both threads and the notifications per packet counted by the
+ * kernel in the ring statistics (these need dev.netmap.stats=1,
+ * which the program sets too).
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <inttypes.h>	/* PRI* macros */
+#include <string.h>	/* strerror */
+#include <stdlib.h>	/* atoi */
+#include <unistd.h>	/* getopt */
+#include <pthread.h>	/* pthread_* */
+#include <time.h>	/* clock_gettime */
+#include <sys/poll.h>
+#ifdef __FreeBSD__
+#include <sys/sysctl.h>	/* sysctlbyname */
+#endif
+#define NETMAP_WITH_LIBS
+#include <net/netmap_user.h>
+
+struct side {
+	struct nm_desc *d;
+	uint64_t pkts;
+	uint64_t polls;
+};
+
+static uint64_t npkts;
+static u_int burst = 512;
+static volatile int stop;
+
+/* set a netmap sysctl (a module parameter on linux) */
+static int
+set_knob(const char *name, int v)
+{
+#ifdef __FreeBSD__
+	char oid[64];
+
+	snprintf(oid, sizeof(oid), "dev.netmap.%s", name);
+	return sysctlbyname(oid, NULL, NULL, &v, sizeof(v));
+#else
+	char path[128];
+	FILE *f;
+
+	snprintf(path, sizeof(path),
+		"/sys/module/netmap_lin/parameters/%s", name);
+	f = fopen(path, "w");
+	if (f == NULL)
+		return -1;
+	fprintf(f, "%d\n", v);
+	return fclose(f);
+#endif
+}
+
+/* sleep until the ring has something for us, 0 on timeout */
+static int
+wait_for(struct side *s, short events)
+{
+	struct pollfd pfd = { .fd = s->d->fd, .events = events };
+	int ret;
+
+	s->polls++;
+	ret = poll(&pfd, 1, 1000);
+	if (ret <= 0) {
+		fprintf(stderr, "poll: %s\n", ret ? strerror(errno) : "timeout");
+		stop = 1;
+		return 0;
+	}
+	return 1;
+}
+
+static void *
+tput_tx(void *arg)
+{
+	struct side *s = arg;
+	struct netmap_ring *ring = NETMAP_TXRING(s->d->nifp, s->d->first_tx_ring);
+
+	while (s->pkts < npkts && !stop) {
+		u_int n = nm_ring_space(ring), i = ring->cur;
+
+		if (n == 0) {
+			wait_for(s, POLLOUT);
+			continue;
+		}
+		if (n > burst)
+			n = burst;
+		if (n > npkts - s->pkts)
+			n = npkts - s->pkts;
+		s->pkts += n;
+		for (; n > 0; n--) {
+			ring->slot[i].len = 60;
+			i = nm_ring_next(ring, i);
+		}
+		ring->head = ring->cur = i;
+		ioctl(s->d->fd, NIOCTXSYNC, NULL);
+	}
+	while (nm_tx_pending(ring) && !stop) /* wait for the last slots */
+		wait_for(s, POLLOUT);
+	return NULL;
+}
+
+static void *
+tput_rx(void *arg)
+{
+	struct side *s = arg;
+	struct netmap_ring *ring = NETMAP_RXRING(s->d->nifp, s->d->first_rx_ring);
+
+	while (s->pkts < npkts && !stop) {
+		if (!wait_for(s, POLLIN))
+			break;
+		s->pkts += nm_ring_space(ring);
+		ring->head = ring->cur = ring->tail;
+	}
+	ioctl(s->d->fd, NIOCRXSYNC, NULL); /* release the last slots */
+	return NULL;
+}
+
+static void *
+pp_master(void *arg)
+{
+	struct side *s = arg;
+	struct netmap_ring *tx = NETMAP_TXRING(s->d->nifp, s->d->first_tx_ring);
+	struct netmap_ring *rx = NETMAP_RXRING(s->d->nifp, s->d->first_rx_ring);
+
+	while (s->pkts < npkts && !stop) {
+		tx->slot[tx->cur].len = 60;
+		tx->head = tx->cur = nm_ring_next(tx, tx->cur);
+		ioctl(s->d->fd, NIOCTXSYNC, NULL);
+		while (nm_ring_space(rx) == 0) {
+			if (!wait_for(s, POLLIN))
+				return NULL;
+		}
+		rx->head = rx->cur = nm_ring_next(rx, rx->cur);
+		s->pkts++;
+	}
+	return NULL;
+}
+
+static void *
+pp_slave(void *arg)
+{
+	struct side *s = arg;
+	struct netmap_ring *tx = NETMAP_TXRING(s->d->nifp, s->d->first_tx_ring);
+	struct netmap_ring *rx = NETMAP_RXRING(s->d->nifp, s->d->first_rx_ring);
+	u_int n;
+
+	while (s->pkts < npkts && !stop) {
+		if (!wait_for(s, POLLIN))
+			break;
+		for (n = nm_ring_space(rx); n > 0; n--) {
+			tx->slot[tx->cur].len = rx->slot[rx->cur].len;
+			tx->head = tx->cur = nm_ring_next(tx, tx->cur);
+			rx->head = rx->cur = nm_ring_next(rx, rx->cur);
+			s->pkts++;
+		}
+		ioctl(s->d->fd, NIOCTXSYNC, NULL);
+	}
+	return NULL;
+}
+
+/* notifications issued for the rings of one endpoint */
+static uint64_t
+notifies(struct side *s)
+{
+	struct netmap_ring *tx = NETMAP_TXRING(s->d->nifp, s->d->first_tx_ring);
+	struct netmap_ring *rx = NETMAP_RXRING(s->d->nifp, s->d->first_rx_ring);
+
+	return NETMAP_RING_STATS(tx)->notifies + NETMAP_RING_STATS(rx)->notifies;
+}
+
+static int
+run(const char *parent, int pingpong)
+{
+	char name[64];
+	struct side m, s;
+	pthread_t tm, ts;
+	struct timespec t0, t1;
+	uint64_t n0, nn;
+	double dt;
+
+	memset(&m, 0, sizeof(m));
+	memset(&s, 0, sizeof(s));
+	stop = 0;
+	snprintf(name, sizeof(name), "%s{1", parent);
+	m.d = nm_open(name, NULL, 0, NULL);
+	if (m.d == NULL) {
+		fprintf(stderr, "cannot open %s\n", name);
+		return -1;
+	}
+	snprintf(name, sizeof(name), "%s}1", parent);
+	s.d = nm_open(name, NULL, NM_OPEN_NO_MMAP, m.d);
+	if (s.d == NULL) {
+		fprintf(stderr, "cannot open %s\n", name);
+		nm_close(m.d);
+		return -1;
+	}
+
+	n0 = notifies(&m) + notifies(&s);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_create(&tm, NULL, pingpong ? pp_master : tput_tx, &m);
+	pthread_create(&ts, NULL, pingpong ? pp_slave : tput_rx, &s);
+	pthread_join(tm, NULL);
+	pthread_join(ts, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	nn = notifies(&m) + notifies(&s) - n0;
+	dt = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	if (s.pkts > 0) {
+		printf("  %" PRIu64 " packets in %.3f s, %.3f Mpps\n",
+			s.pkts, dt, s.pkts / dt / 1e6);
+		printf("  polls/packet: master %.4f slave %.4f\n",
+			(double)m.polls / s.pkts, (double)s.polls / s.pkts);
+		printf("  notifies/packet: %.4f\n", (double)nn / s.pkts);
+	}
+	nm_close(s.d);
+	nm_close(m.d);
+	return stop ? -1 : 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"usage: pipewake [-p parent] [-n packets] [-b burst] [-P]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *parent = "vale0:pw";
+	int ch, pingpong = 0, evidx, error = 0;
+
+	while ((ch = getopt(argc, argv, "p:n:b:P")) != -1) {
+		switch (ch) {
+		case 'p':
+			parent = optarg;
+			break;
+		case 'n':
+			npkts = strtoull(optarg, NULL, 0);
+			break;
+		case 'b':
+			burst = atoi(optarg);
+			break;
+		case 'P':
+			pingpong = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (burst == 0)
+		usage();
+	if (npkts == 0)
+		npkts = pingpong ? 1000000 : 10000000;
+
+	if (set_knob("stats", 1))
+		fprintf(stderr, "cannot enable the ring statistics: %s\n",
+			strerror(errno));
+	for (evidx = 1; evidx >= 0; evidx--) {
+		if (set_knob("pipe_evidx", evidx)) {
+			fprintf(stderr, "cannot set pipe_evidx: %s\n",
+				strerror(errno));
+			return 1;
+		}
+		printf("%s %s, suppression %s\n", parent,
+			pingpong ? "ping-pong" : "throughput",
+			evidx ? "on" : "off");
+		error |= run(parent, pingpong);
+	}
+	set_knob("pipe_evidx", 1);
+	return error ? 1 : 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2015 Universita` di Pisa. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * testmbq: enqueue/dequeue microbenchmark for the mbuf queues of
+ * netmap (sys/dev/netmap/netmap_mbq.c, compiled here in userspace).
+ * Several producer threads push mbufs to one queue, one consumer
+ * drains it, as the generic adapter and the host rings do.
+ *
+ *	testmbq [-p producers] [-n mbufs per producer] [-m mp|safe]
+ *
+ * mp uses the lock-free inbox (mbq_mp_enqueue, mbq_mp_splice),
+ * safe the spinlocked queue (mbq_safe_enqueue, mbq_safe_dequeue).
+ * Without -m both are run. The consumer also checks that the mbufs
+ * of each producer arrive in order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>	/* strcmp */
+#include <stdint.h>
+#include <inttypes.h>	/* PRI* macros */
+#include <unistd.h>	/* getopt */
+#include <pthread.h>	/* pthread_*, spinlocks */
+#include <time.h>	/* clock_gettime */
+#include <sys/types.h>
+#ifndef linux
+#include <machine/atomic.h>
+#endif
+
+#define D(format, ...)				\
+	fprintf(stderr, "%s [%d] " format "\n",	\
+	__FUNCTION__, __LINE__, ##__VA_ARGS__)
+
+/* the little of the kernel environment that netmap_mbq.c needs */
+struct mbuf {
+	struct mbuf	*m_nextpkt;
+	u_int		src;	/* producer */
+	u_int		seq;	/* position in the producer stream */
+};
+#define m_freem(m)	(void)(m)	/* the mbufs are owned by main() */
+
+struct mtx {
+	pthread_spinlock_t l;
+};
+#define mtx_init(m, n, t, f)	pthread_spin_init(&(m)->l, PTHREAD_PROCESS_PRIVATE)
+#define mtx_destroy(m)		pthread_spin_destroy(&(m)->l)
+#define mtx_lock_spin(m)	pthread_spin_lock(&(m)->l)
+#define mtx_unlock_spin(m)	pthread_spin_unlock(&(m)->l)
+
+#ifdef linux
+typedef struct mtx safe_spinlock_t;
+typedef struct { volatile int counter; } atomic_t;
+#define cmpxchg(p, o, n)	__sync_val_compare_and_swap((p), (o), (n))
+#define xchg(p, n)		__atomic_exchange_n((p), (n), __ATOMIC_SEQ_CST)
+#define atomic_add(v, p)	(void)__sync_fetch_and_add(&(p)->counter, (v))
+#endif /* linux */
+
+#define NM_MBQ_USERSPACE
+#include "dev/netmap/netmap_mbq.c"
+
+struct glob_arg {
+	struct mbq	q;
+	int		mp;		/* use the inbox */
+	u_int		nprod;
+	u_int		n;		/* mbufs per producer */
+	volatile int	go;
+};
+
+struct targ {
+	struct glob_arg	*g;
+	struct mbuf	*m;		/* the mbufs of this producer */
+	pthread_t	thread;
+};
+
+static void *
+producer(void *arg)
+{
+	struct targ *t = arg;
+	struct glob_arg *g = t->g;
+	u_int i;
+
+	while (!g->go)
+		;
+	for (i = 0; i < g->n; i++) {
+		if (g->mp)
+			mbq_mp_enqueue(&g->q, &t->m[i]);
+		else
+			mbq_safe_enqueue(&g->q, &t->m[i]);
+	}
+	return NULL;
+}
+
+/* drain the queue, return the number of mbufs out of order */
+static uint64_t
+consumer(struct glob_arg *g)
+{
+	uint64_t got = 0, tot = (uint64_t)g->nprod * g->n, errors = 0;
+	u_int *next = calloc(g->nprod, sizeof(*next));
+	struct mbq priv;
+	struct mbuf *m;
+
+	mbq_init(&priv);
+	while (got < tot) {
+		if (g->mp) {
+			mbq_mp_splice(&g->q, &priv);
+			m = mbq_dequeue(&priv);
+		} else {
+			m = mbq_safe_dequeue(&g->q);
+		}
+		for (; m; m = g->mp ? mbq_dequeue(&priv) : NULL) {
+			if (m->seq != next[m->src])
+				errors++;
+			next[m->src] = m->seq + 1;
+			got++;
+		}
+	}
+	free(next);
+	return errors;
+}
+
+static int
+run(u_int nprod, u_int n, int mp)
+{
+	struct glob_arg g;
+	struct targ *ta;
+	struct timespec t0, t1;
+	uint64_t errors;
+	double dt;
+	u_int i, j;
+
+	memset(&g, 0, sizeof(g));
+	g.mp = mp;
+	g.nprod = nprod;
+	g.n = n;
+	mbq_safe_init(&g.q);
+	ta = calloc(nprod, sizeof(*ta));
+	if (ta == NULL)
+		return -1;
+	for (i = 0; i < nprod; i++) {
+		ta[i].g = &g;
+		ta[i].m = calloc(n, sizeof(struct mbuf));
+		if (ta[i].m == NULL) {
+			D("cannot allocate %u mbufs", n);
+			return -1;
+		}
+		for (j = 0; j < n; j++) {
+			ta[i].m[j].src = i;
+			ta[i].m[j].seq = j;
+		}
+		pthread_create(&ta[i].thread, NULL, producer, &ta[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	g.go = 1;
+	errors = consumer(&g);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	dt = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	for (i = 0; i < nprod; i++) {
+		pthread_join(ta[i].thread, NULL);
+		free(ta[i].m);
+	}
+	free(ta);
+	mbq_safe_destroy(&g.q);
+
+	printf("%-4s %u producers: %" PRIu64 " mbufs in %.3f s, %.2f Mpps, "
+		"%" PRIu64 " out of order\n", mp ? "mp" : "safe", nprod,
+		(uint64_t)nprod * n, dt, nprod * (double)n / dt / 1e6, errors);
+	return errors ? -1 : 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"usage: testmbq [-p producers] [-n mbufs] [-m mp|safe]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	u_int nprod = 4, n = 1 << 20;
+	int ch, mode = -1, error = 0;
+
+	while ((ch = getopt(argc, argv, "p:n:m:")) != -1) {
+		switch (ch) {
+		case 'p':
+			nprod = atoi(optarg);
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "mp"))
+				mode = 1;
+			else if (!strcmp(optarg, "safe"))
+				mode = 0;
+			else
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (nprod == 0 || n == 0)
+		usage();
+
+	if (mode != 0)
+		error |= run(nprod, n, 1);
+	if (mode != 1)
+		error |= run(nprod, n, 0);
+	return error ? 1 : 0;
+}
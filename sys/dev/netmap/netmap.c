@@ -319,7 +319,8 @@ ports attached to the switch)
  *       concurrently:
  *           1) ioctl(NIOCTXSYNC)/netmap_poll() in process context
  *               kring->nm_sync() == generic_netmap_txsync()
- *                   linux:   dev_queue_xmit() with NM_MAGIC_PRIORITY_TX
+ *                   linux:   netdev_start_xmit() with NM_MAGIC_PRIORITY_TX
+ *                       (dev_queue_xmit() if generic_txqdisc is set)
  *                       generic_ndo_start_xmit()
  *                           orig. dev. start_xmit
  *                   FreeBSD: na->if_transmit() == orig. dev if_transmit
@@ -328,10 +329,10 @@ ports attached to the switch)
  *    - rx from netmap userspace:
  *           1) ioctl(NIOCRXSYNC)/netmap_poll() in process context
  *               kring->nm_sync() == generic_netmap_rxsync()
- *                   mbq_safe_dequeue()
+ *                   mbq_mp_splice()
  *           2) device driver
  *               generic_rx_handler()
- *                   mbq_safe_enqueue()
+ *                   mbq_mp_enqueue()
  *                   na->nm_notify() == netmap_notify()
  *    - rx from host stack:
  *        concurrently:
@@ -508,11 +509,18 @@ int netmap_verbose;
 
 static int netmap_no_timestamp; /* don't timestamp on rxsync */
 
+int netmap_stats = 1; /* update the per-ring statistics */
+int netmap_latency = 0; /* collect latency histograms */
+
 SYSCTL_NODE(_dev, OID_AUTO, netmap, CTLFLAG_RW, 0, "Netmap args");
 SYSCTL_INT(_dev_netmap, OID_AUTO, verbose,
     CTLFLAG_RW, &netmap_verbose, 0, "Verbose mode");
 SYSCTL_INT(_dev_netmap, OID_AUTO, no_timestamp,
     CTLFLAG_RW, &netmap_no_timestamp, 0, "no_timestamp");
+SYSCTL_INT(_dev_netmap, OID_AUTO, stats,
+    CTLFLAG_RW, &netmap_stats, 0, "Update per-ring statistics");
+SYSCTL_INT(_dev_netmap, OID_AUTO, latency,
+    CTLFLAG_RW, &netmap_latency, 0, "Collect latency histograms");
 int netmap_mitigate = 1;
 SYSCTL_INT(_dev_netmap, OID_AUTO, mitigate, CTLFLAG_RW, &netmap_mitigate, 0, "");
 int netmap_no_pendintr = 1;
@@ -543,6 +551,13 @@ static int netmap_admode = NETMAP_ADMODE_BEST;
 int netmap_generic_mit = 100*1000;   /* Generic mitigation interval in nanoseconds. */
 int netmap_generic_ringsize = 1024;   /* Generic ringsize. */
 int netmap_generic_rings = 1;   /* number of queues in generic. */
+int netmap_generic_txqdisc = 0;	/* linux: generic tx through the qdisc. */
+int netmap_generic_rss = 0;	/* software rss in generic rx. */
+int netmap_generic_mit_adaptive = 0;	/* adapt generic_mit to the rate. */
+int netmap_generic_mit_latency = 100*1000; /* max adaptive interval, ns. */
+int netmap_generic_mit_batch = 64;	/* target packets per wakeup. */
+int netmap_generic_rx_backlog = 0;	/* mbufs queued per rx ring, 0: slots. */
+int netmap_generic_rx_burst = 4;	/* max backlog growth in a burst. */
 
 SYSCTL_INT(_dev_netmap, OID_AUTO, flags, CTLFLAG_RW, &netmap_flags, 0 , "");
 SYSCTL_INT(_dev_netmap, OID_AUTO, fwd, CTLFLAG_RW, &netmap_fwd, 0 , "");
@@ -551,6 +566,13 @@ SYSCTL_INT(_dev_netmap, OID_AUTO, admode, CTLFLAG_RW, &netmap_admode, 0 , "");
 SYSCTL_INT(_dev_netmap, OID_AUTO, generic_mit, CTLFLAG_RW, &netmap_generic_mit, 0 , "");
 SYSCTL_INT(_dev_netmap, OID_AUTO, generic_ringsize, CTLFLAG_RW, &netmap_generic_ringsize, 0 , "");
 SYSCTL_INT(_dev_netmap, OID_AUTO, generic_rings, CTLFLAG_RW, &netmap_generic_rings, 0 , "");
+SYSCTL_INT(_dev_netmap, OID_AUTO, generic_txqdisc, CTLFLAG_RW, &netmap_generic_txqdisc, 0 , "");
+SYSCTL_INT(_dev_netmap, OID_AUTO, generic_rss, CTLFLAG_RW, &netmap_generic_rss, 0 , "");
+SYSCTL_INT(_dev_netmap, OID_AUTO, generic_mit_adaptive, CTLFLAG_RW, &netmap_generic_mit_adaptive, 0 , "");
+SYSCTL_INT(_dev_netmap, OID_AUTO, generic_mit_latency, CTLFLAG_RW, &netmap_generic_mit_latency, 0 , "");
+SYSCTL_INT(_dev_netmap, OID_AUTO, generic_mit_batch, CTLFLAG_RW, &netmap_generic_mit_batch, 0 , "");
+SYSCTL_INT(_dev_netmap, OID_AUTO, generic_rx_backlog, CTLFLAG_RW, &netmap_generic_rx_backlog, 0 , "");
+SYSCTL_INT(_dev_netmap, OID_AUTO, generic_rx_burst, CTLFLAG_RW, &netmap_generic_rx_burst, 0 , "");
 
 NMG_LOCK_T	netmap_global_lock;
 
@@ -826,6 +848,24 @@ netmap_krings_create(struct netmap_adapter *na, u_int tailroom)
 	}
 	na->rx_rings = na->tx_rings + ntx;
 
+	len = NM_BITMAP_LONGS(ntx) + NM_BITMAP_LONGS(nrx);
+	na->tx_pending = malloc(len * sizeof(u_long), M_DEVBUF, M_NOWAIT | M_ZERO);
+	if (na->tx_pending == NULL) {
+		D("Cannot allocate pending bitmaps");
+		free(na->tx_rings, M_DEVBUF);
+		na->tx_rings = na->rx_rings = NULL;
+		return ENOMEM;
+	}
+	na->rx_pending = na->tx_pending + NM_BITMAP_LONGS(ntx);
+
+	if (netmap_latency) {
+		/* optional, go on without histograms if this fails */
+		na->na_lat = malloc(NM_NCPUS * sizeof(struct netmap_lat),
+			M_DEVBUF, M_NOWAIT | M_ZERO);
+		if (na->na_lat == NULL)
+			D("%s: no memory for the latency histograms", na->name);
+	}
+
 	/*
 	 * All fields in krings are 0 except the one initialized below.
 	 * but better be explicit on important kring fields.
@@ -907,9 +947,19 @@ netmap_krings_delete(struct netmap_adapter *na)
 	for ( ; kring != na->tailroom; kring++) {
 		mtx_destroy(&kring->q_lock);
 		netmap_knlist_destroy(&kring->si);
+#ifdef WITH_MONITOR
+		if (kring->monitors)
+			free(kring->monitors, M_DEVBUF);
+#endif
 	}
 	free(na->tx_rings, M_DEVBUF);
 	na->tx_rings = na->rx_rings = na->tailroom = NULL;
+	free(na->tx_pending, M_DEVBUF);
+	na->tx_pending = na->rx_pending = NULL;
+	if (na->na_lat) {
+		free(na->na_lat, M_DEVBUF);
+		na->na_lat = NULL;
+	}
 }
 
 
@@ -1216,7 +1266,7 @@ netmap_txsync_to_host(struct netmap_adapter *na)
 
 /*
  * rxsync backend for packets coming from the host stack.
- * They have been put in kring->rx_queue by netmap_transmit().
+ * They have been put in the inbox of kring->rx_queue by netmap_transmit().
  * We protect access to the kring using kring->rx_queue.lock
  *
  * This routine also does the selrecord if called from the poll handler
@@ -1244,6 +1294,7 @@ netmap_rxsync_from_host(struct netmap_adapter *na, struct thread *td, void *pwai
 	mbq_lock(q);
 
 	/* First part: import newly received packets */
+	mbq_mp_splice(q, q);
 	n = mbq_len(q);
 	if (n) { /* grab packets from the queue */
 		struct mbuf *m;
@@ -1556,6 +1607,8 @@ nm_txsync_prologue(struct netmap_kring *kring)
 			ring->tail, kring->rtail);
 		ring->tail = kring->rtail;
 	}
+	if (netmap_stats) /* new slots are in rhead .. head */
+		nm_kr_stats_slots(kring, kring->rhead, head);
 	kring->rhead = head;
 	kring->rcur = cur;
 	return head;
@@ -1715,6 +1768,7 @@ netmap_interp_ringid(struct netmap_priv_d *priv, uint16_t ringid, uint32_t flags
 	struct netmap_adapter *na = priv->np_na;
 	u_int j, i = ringid & NETMAP_RING_MASK;
 	u_int reg = flags & NR_REG_MASK;
+	int g;
 
 	if (reg == NR_REG_DEFAULT) {
 		/* convert from old ringid to flags */
@@ -1728,9 +1782,17 @@ netmap_interp_ringid(struct netmap_priv_d *priv, uint16_t ringid, uint32_t flags
 		D("deprecated API, old ringid 0x%x -> ringid %x reg %d", ringid, i, reg);
 	}
 	switch (reg) {
+	case NR_REG_PIPE_SLAVE:
+		/* the slave endpoints of a pipe group own one ring each */
+		g = netmap_pipe_group_ring(na, i);
+		if (g >= 0) {
+			priv->np_txqfirst = priv->np_rxqfirst = g;
+			priv->np_txqlast = priv->np_rxqlast = g + 1;
+			break;
+		}
+		/* fallthrough */
 	case NR_REG_ALL_NIC:
 	case NR_REG_PIPE_MASTER:
-	case NR_REG_PIPE_SLAVE:
 		priv->np_txqfirst = 0;
 		priv->np_txqlast = na->num_tx_rings;
 		priv->np_rxqfirst = 0;
@@ -1996,6 +2058,410 @@ err:
 
 
 
+/*
+ * Run txsync (t == NR_TX) or rxsync (t == NR_RX) on the rings bound
+ * to priv. If last != 0 only the rings in [first, last), relative to
+ * the first bound ring, are synced. Used by NIOC?XSYNC and NIOCSYNCV.
+ * If ready is not NULL, *ready is set when at least one of the rings
+ * has slots available to userspace after the sync.
+ *
+ * Return 0 on success, errno otherwise.
+ */
+static int
+netmap_priv_sync(struct netmap_priv_d *priv, enum txrx t,
+	u_int first, u_int last, int *ready)
+{
+	struct netmap_adapter *na;
+	struct netmap_kring *krings;
+	u_int i, qfirst, qlast;
+	uint64_t t0 = 0;
+
+	if (priv->np_nifp == NULL)
+		return ENXIO;
+	mb(); /* make sure following reads are not from cache */
+
+	na = priv->np_na;      /* we have a reference */
+
+	if (na == NULL) {
+		D("Internal error: nifp != NULL && na == NULL");
+		return ENXIO;
+	}
+
+	if (!nm_netmap_on(na))
+		return ENXIO;
+
+	if (t == NR_TX) {
+		krings = na->tx_rings;
+		qfirst = priv->np_txqfirst;
+		qlast = priv->np_txqlast;
+	} else {
+		krings = na->rx_rings;
+		qfirst = priv->np_rxqfirst;
+		qlast = priv->np_rxqlast;
+	}
+	if (last != 0) {
+		if (first >= last || last > qlast - qfirst)
+			return EINVAL;
+		qlast = qfirst + last;
+		qfirst += first;
+	}
+
+	for (i = qfirst; i < qlast; i++) {
+		struct netmap_kring *kring = krings + i;
+		if (nm_kr_tryget(kring))
+			return EBUSY;
+		if (NM_LAT_ON(na))
+			t0 = NM_CYCLES();
+		if (t == NR_TX) {
+			if (netmap_verbose & NM_VERB_TXSYNC)
+				D("pre txsync ring %d cur %d hwcur %d",
+				    i, kring->ring->cur,
+				    kring->nr_hwcur);
+			if (nm_txsync_prologue(kring) >= kring->nkr_num_slots) {
+				netmap_ring_reinit(kring);
+			} else {
+				kring->nm_sync(kring, NAF_FORCE_RECLAIM);
+			}
+			if (netmap_verbose & NM_VERB_TXSYNC)
+				D("post txsync ring %d cur %d hwcur %d",
+				    i, kring->ring->cur,
+				    kring->nr_hwcur);
+		} else {
+			kring->nm_sync(kring, NAF_FORCE_READ);
+			microtime(&kring->ring->ts);
+		}
+		if (t0) {
+			nm_lat_record(na, t == NR_TX ? NM_LAT_TXSYNC :
+				NM_LAT_RXSYNC, NM_CYCLES() - t0);
+			kring->nkr_notify_cycles = 0; /* not a wakeup */
+			t0 = 0;
+		}
+		/* after a sync we can use kring->rcur, rtail */
+		if (ready && kring->rcur != kring->rtail)
+			*ready = 1;
+		nm_kr_put(kring);
+	}
+
+	return 0;
+}
+
+
+/*
+ * NIOCSYNCV: sync the rings of several netmap file descriptors
+ * in one system call. Errors on the individual descriptors are
+ * reported in nsr_error, the return value only reflects problems
+ * with the request itself.
+ */
+static int
+netmap_syncv(struct nm_syncv *nv, struct thread *td)
+{
+	struct nm_syncreq *reqs;
+	void *ureqs = (void *)(uintptr_t)nv->nv_reqs;
+	size_t len;
+	u_int i;
+	int error = 0;
+
+	if (nv->nv_count == 0 || nv->nv_count > NM_SYNCV_MAX)
+		return EINVAL;
+	len = nv->nv_count * sizeof(*reqs);
+	reqs = malloc(len, M_DEVBUF, M_NOWAIT);
+	if (reqs == NULL)
+		return ENOMEM;
+	if (copyin(ureqs, reqs, len)) {
+		error = EFAULT;
+		goto out;
+	}
+
+	bzero(nv->nv_ready, sizeof(nv->nv_ready));
+	nv->nv_nready = 0;
+	for (i = 0; i < nv->nv_count; i++) {
+		struct nm_syncreq *r = &reqs[i];
+		struct netmap_priv_d *priv;
+		void *cookie;
+		int ready = 0;
+
+		r->nsr_error = netmap_fd_getpriv(r->nsr_fd, td, &priv, &cookie);
+		if (r->nsr_error)
+			continue;
+		if (r->nsr_flags & NR_SYNC_TX)
+			r->nsr_error = netmap_priv_sync(priv, NR_TX,
+				r->nsr_first, r->nsr_last, &ready);
+		if (r->nsr_error == 0 && (r->nsr_flags & NR_SYNC_RX))
+			r->nsr_error = netmap_priv_sync(priv, NR_RX,
+				r->nsr_first, r->nsr_last, &ready);
+		netmap_fd_putpriv(cookie, td);
+		if (ready) {
+			nv->nv_ready[i / 64] |= (uint64_t)1 << (i % 64);
+			nv->nv_nready++;
+		}
+	}
+
+	if (copyout(reqs, ureqs, len))
+		error = EFAULT;
+out:
+	free(reqs, M_DEVBUF);
+	return error;
+}
+
+
+/*
+ * NM_CFG_LATENCY: merge the per-cpu histograms of a port.
+ * Called with NMG_LOCK held.
+ */
+static int
+netmap_lat_get(struct netmap_priv_d *priv, struct nm_lat_req *req)
+{
+	struct netmap_adapter *na = NULL;
+	struct nmreq nmr;
+	u_int c, b;
+	int error = 0;
+
+	if (req->nlr_hist >= NM_LAT_NUM)
+		return EINVAL;
+	if (req->nlr_name[0] == '\0') {
+		if (priv->np_nifp == NULL)
+			return ENXIO;
+		na = priv->np_na;
+		netmap_adapter_get(na);
+	} else {
+		bzero(&nmr, sizeof(nmr));
+		strncpy(nmr.nr_name, req->nlr_name, sizeof(nmr.nr_name) - 1);
+		nmr.nr_version = NETMAP_API;
+		error = netmap_get_na(&nmr, &na, 0 /* don't create */);
+		if (error)
+			return error;
+	}
+	if (na->na_lat == NULL) {
+		/* not registered, or dev.netmap.latency was not set */
+		error = ENOENT;
+		goto out;
+	}
+	bzero(req->nlr_bucket, sizeof(req->nlr_bucket));
+	for (c = 0; c < NM_NCPUS; c++) {
+		uint64_t *h = na->na_lat[c].h[req->nlr_hist];
+
+		for (b = 0; b < NM_LAT_BUCKETS; b++) {
+			req->nlr_bucket[b] += h[b];
+			if (req->nlr_flags & NM_LAT_RESET)
+				h[b] = 0;
+		}
+	}
+out:
+	netmap_adapter_put(na);
+	return error;
+}
+
+
+/*
+ * NM_CFG_RSS: look up the port and let the generic adapter
+ * do the work. Called with NMG_LOCK held.
+ */
+static int
+netmap_rss_config(struct netmap_priv_d *priv, struct nm_rss_req *req)
+{
+	struct netmap_adapter *na = NULL;
+	struct nmreq nmr;
+	int error = 0;
+
+	if (req->nrs_name[0] == '\0') {
+		if (priv->np_nifp == NULL)
+			return ENXIO;
+		na = priv->np_na;
+		netmap_adapter_get(na);
+	} else {
+		bzero(&nmr, sizeof(nmr));
+		strncpy(nmr.nr_name, req->nrs_name, sizeof(nmr.nr_name) - 1);
+		nmr.nr_version = NETMAP_API;
+		error = netmap_get_na(&nmr, &na, 0 /* don't create */);
+		if (error)
+			return error;
+	}
+#ifdef WITH_GENERIC
+	if (na->na_flags & NAF_GENERIC)
+		error = generic_rss_config(na, req);
+	else
+#endif /* WITH_GENERIC */
+		error = EOPNOTSUPP;
+	netmap_adapter_put(na);
+	return error;
+}
+
+
+/*
+ * Resize the krings [first, last) of one direction, see
+ * NM_CFG_RING_RESIZE. Each kring is stopped while we work on it.
+ */
+static int
+netmap_resize_krings(struct netmap_adapter *na, enum txrx t,
+	u_int first, u_int last, u_int nslots)
+{
+	struct netmap_kring *kring;
+	u_int i;
+	int error = 0;
+
+	for (i = first; i < last && !error; i++) {
+		kring = (t == NR_TX) ? na->tx_rings + i : na->rx_rings + i;
+		if (kring->nkr_num_slots == nslots)
+			continue;
+		if (t == NR_TX)
+			netmap_set_txring(na, i, 1 /* stopped */);
+		else
+			netmap_set_rxring(na, i, 1 /* stopped */);
+		if (kring->nkr_leases) {
+			/* VALE: wait for senders still copying in the slots
+			 * they leased before the ring was stopped
+			 */
+			mtx_lock(&kring->q_lock);
+			while (kring->nkr_hwlease != kring->nr_hwtail) {
+				mtx_unlock(&kring->q_lock);
+				tsleep(kring, 0, "NM_RESIZE", 4);
+				mtx_lock(&kring->q_lock);
+			}
+			mtx_unlock(&kring->q_lock);
+		}
+		error = netmap_mem_ring_resize(na, kring, nslots);
+		if (error == 0) {
+			/* the ring starts again empty */
+			kring->rhead = kring->rcur = kring->nr_hwcur = 0;
+			kring->rtail = kring->nr_hwtail =
+				(t == NR_TX) ? nslots - 1 : 0;
+			kring->nkr_hwlease = kring->nr_hwtail;
+			kring->nkr_lease_idx = 0;
+			kring->ring->head = kring->ring->cur = kring->rhead;
+			kring->ring->tail = kring->rtail;
+		}
+		if (t == NR_TX)
+			netmap_set_txring(na, i, 0);
+		else
+			netmap_set_rxring(na, i, 0);
+	}
+	return error;
+}
+
+
+/*
+ * NM_CFG_RING_RESIZE: change the size of some rings of the port
+ * bound to priv. Called with NMG_LOCK held.
+ */
+static int
+netmap_ring_resize(struct netmap_priv_d *priv, struct nm_resize_req *req)
+{
+	struct netmap_adapter *na;
+	u_int first = req->nrr_first, last = req->nrr_last;
+	u_int ntx, nrx, maxslots;
+	int error = 0;
+
+	if (priv->np_nifp == NULL)
+		return ENXIO;
+	na = priv->np_na;
+	if (!nm_netmap_on(na))
+		return ENXIO;
+	if (!(na->na_flags & NAF_RESIZABLE))
+		return EOPNOTSUPP;
+
+	ntx = (req->nrr_flags & NR_RESIZE_TX) ? na->num_tx_rings : 0;
+	nrx = (req->nrr_flags & NR_RESIZE_RX) ? na->num_rx_rings : 0;
+	if (ntx == 0 && nrx == 0)
+		return EINVAL;
+	maxslots = ntx ? na->num_tx_desc : na->num_rx_desc;
+	if (nrx && na->num_rx_desc < maxslots)
+		maxslots = na->num_rx_desc;
+	req->nrr_max_slots = maxslots;
+	if (last == 0)
+		last = (ntx > nrx) ? ntx : nrx;
+	if (first >= last || (ntx && last > ntx) || (nrx && last > nrx))
+		return EINVAL;
+	if (req->nrr_slots < 2 || req->nrr_slots > maxslots)
+		return EINVAL;
+
+	if (ntx)
+		error = netmap_resize_krings(na, NR_TX, first, last,
+			req->nrr_slots);
+	if (!error && nrx)
+		error = netmap_resize_krings(na, NR_RX, first, last,
+			req->nrr_slots);
+
+	/* report the size actually in use */
+	req->nrr_slots = ntx ? na->tx_rings[first].nkr_num_slots :
+		na->rx_rings[first].nkr_num_slots;
+	return error;
+}
+
+
+/*
+ * NIOCCONFIG requests with an empty name, handled by netmap.
+ * The first field in ifr->data selects the command.
+ */
+/*
+ * Copy in and validate the filter program of an NM_CFG_FILTER
+ * request. On success *fp is a malloc'ed copy, to be freed with
+ * free(M_DEVBUF), or NULL if the request removes the filter.
+ */
+int
+nm_filter_copyin(struct nm_filter_req *req, struct nm_bpf_insn **fp)
+{
+	struct nm_bpf_insn *f;
+	size_t len = req->nfr_len * sizeof(*f);
+
+	*fp = NULL;
+	if (req->nfr_len > NM_FILTER_MAXLEN)
+		return EINVAL;
+	if (req->nfr_len == 0)
+		return 0;
+	f = malloc(len, M_DEVBUF, M_NOWAIT);
+	if (f == NULL)
+		return ENOMEM;
+	if (copyin((void *)(uintptr_t)req->nfr_prog, f, len)) {
+		free(f, M_DEVBUF);
+		return EFAULT;
+	}
+	if (!nm_bpf_validate(f, req->nfr_len)) {
+		D("invalid filter");
+		free(f, M_DEVBUF);
+		return EINVAL;
+	}
+	*fp = f;
+	return 0;
+}
+
+static int
+netmap_config(struct netmap_priv_d *priv, struct nm_ifreq *ifr)
+{
+	uint16_t cmd = *(uint16_t *)(void *)ifr->data;
+	int error;
+
+	NMG_LOCK();
+	switch (cmd) {
+	case NM_CFG_LATENCY:
+		error = netmap_lat_get(priv, (struct nm_lat_req *)ifr->data);
+		break;
+	case NM_CFG_RING_RESIZE:
+		error = netmap_ring_resize(priv, (struct nm_resize_req *)ifr->data);
+		break;
+	case NM_CFG_RSS:
+		error = netmap_rss_config(priv, (struct nm_rss_req *)ifr->data);
+		break;
+	case NM_CFG_FILTER:
+		if (priv->np_na && (priv->np_na->na_flags & NAF_BDG_TAP))
+			error = netmap_bdg_tap_filter(priv,
+				(struct nm_filter_req *)ifr->data);
+		else
+			error = netmap_monitor_filter(priv,
+				(struct nm_filter_req *)ifr->data);
+		break;
+	case NM_CFG_SAMPLE:
+		error = netmap_monitor_sample_config(priv,
+			(struct nm_sample_req *)ifr->data);
+		break;
+	default:
+		error = EINVAL;
+		break;
+	}
+	NMG_UNLOCK();
+	return error;
+}
+
+
 /*
  * ioctl(2) support for the "netmap" device.
  *
@@ -2005,6 +2471,7 @@ err:
  * - NIOCREGIF
  * - NIOCTXSYNC
  * - NIOCRXSYNC
+ * - NIOCSYNCV
  *
  * Return 0 on success, errno otherwise.
  */
@@ -2016,9 +2483,8 @@ netmap_ioctl(struct cdev *dev, u_long cmd, caddr_t data,
 	struct nmreq *nmr = (struct nmreq *) data;
 	struct netmap_adapter *na = NULL;
 	int error;
-	u_int i, qfirst, qlast;
+	u_int i;
 	struct netmap_if *nifp;
-	struct netmap_kring *krings;
 
 	(void)dev;	/* UNUSED */
 	(void)fflag;	/* UNUSED */
@@ -2160,71 +2626,26 @@ netmap_ioctl(struct cdev *dev, u_long cmd, caddr_t data,
 
 	case NIOCTXSYNC:
 	case NIOCRXSYNC:
-		nifp = priv->np_nifp;
-
-		if (nifp == NULL) {
-			error = ENXIO;
-			break;
-		}
-		mb(); /* make sure following reads are not from cache */
-
-		na = priv->np_na;      /* we have a reference */
+		error = netmap_priv_sync(priv, cmd == NIOCTXSYNC ? NR_TX : NR_RX,
+			0, 0, NULL);
+		break;
 
-		if (na == NULL) {
-			D("Internal error: nifp != NULL && na == NULL");
-			error = ENXIO;
-			break;
-		}
+	case NIOCSYNCV:
+		error = netmap_syncv((struct nm_syncv *)data, td);
+		break;
 
-		if (!nm_netmap_on(na)) {
-			error = ENXIO;
+	case NIOCCONFIG:
+		if (((struct nm_ifreq *)data)->nifr_name[0] == '\0') {
+			/* handled by netmap itself */
+			error = netmap_config(priv, (struct nm_ifreq *)data);
 			break;
 		}
-
-		if (cmd == NIOCTXSYNC) {
-			krings = na->tx_rings;
-			qfirst = priv->np_txqfirst;
-			qlast = priv->np_txqlast;
-		} else {
-			krings = na->rx_rings;
-			qfirst = priv->np_rxqfirst;
-			qlast = priv->np_rxqlast;
-		}
-
-		for (i = qfirst; i < qlast; i++) {
-			struct netmap_kring *kring = krings + i;
-			if (nm_kr_tryget(kring)) {
-				error = EBUSY;
-				goto out;
-			}
-			if (cmd == NIOCTXSYNC) {
-				if (netmap_verbose & NM_VERB_TXSYNC)
-					D("pre txsync ring %d cur %d hwcur %d",
-					    i, kring->ring->cur,
-					    kring->nr_hwcur);
-				if (nm_txsync_prologue(kring) >= kring->nkr_num_slots) {
-					netmap_ring_reinit(kring);
-				} else {
-					kring->nm_sync(kring, NAF_FORCE_RECLAIM);
-				}
-				if (netmap_verbose & NM_VERB_TXSYNC)
-					D("post txsync ring %d cur %d hwcur %d",
-					    i, kring->ring->cur,
-					    kring->nr_hwcur);
-			} else {
-				kring->nm_sync(kring, NAF_FORCE_READ);
-				microtime(&na->rx_rings[i].ring->ts);
-			}
-			nm_kr_put(kring);
-		}
-
-		break;
-
 #ifdef WITH_VALE
-	case NIOCCONFIG:
 		error = netmap_bdg_config(nmr);
-		break;
+#else
+		error = EOPNOTSUPP;
 #endif
+		break;
 #ifdef __FreeBSD__
 	case FIONBIO:
 	case FIOASYNC:
@@ -2260,13 +2681,33 @@ netmap_ioctl(struct cdev *dev, u_long cmd, caddr_t data,
 		error = EOPNOTSUPP;
 #endif /* linux */
 	}
-out:
 
 	CURVNET_RESTORE();
 	return (error);
 }
 
 
+/*
+ * Latency histograms for a sync done in netmap_poll(), started at t0.
+ * Also account for the time since the first notification on the
+ * ring, which is what woke us up.
+ */
+static void
+nm_lat_poll(struct netmap_adapter *na, struct netmap_kring *kring,
+	u_int hist, uint64_t t0)
+{
+	uint64_t now = NM_CYCLES();
+	uint64_t notified = kring->nkr_notify_cycles;
+
+	nm_lat_record(na, hist, now - t0);
+	if (notified) {
+		kring->nkr_notify_cycles = 0;
+		if (notified < t0)
+			nm_lat_record(na, NM_LAT_WAKEUP, t0 - notified);
+	}
+}
+
+
 /*
  * select(2) and poll(2) handlers for the "netmap" device.
  *
@@ -2298,6 +2739,13 @@ netmap_poll(struct cdev *dev, int events, struct thread *td)
 	 * retry_tx (and retry_rx, later) prevent looping forever.
 	 */
 	int retry_tx = 1, retry_rx = 1;
+	/*
+	 * When bound to all rings, the first round only syncs the rings
+	 * marked as pending by nm_notify() (and those with work from
+	 * userspace). The round after the selrecord() scans all rings.
+	 */
+	int pending_tx, pending_rx;
+	uint64_t t0 = 0;	/* latency histograms */
 
 	(void)pwait;
 	mbq_init(&q);
@@ -2349,6 +2797,8 @@ netmap_poll(struct cdev *dev, int events, struct thread *td)
 	 */
 	check_all_tx = nm_tx_si_user(priv);
 	check_all_rx = nm_rx_si_user(priv);
+	pending_tx = check_all_tx && na->tx_pending != NULL;
+	pending_rx = check_all_rx && na->rx_pending != NULL;
 
 	/*
 	 * We start with a lock free round which is cheap if we have
@@ -2391,10 +2841,16 @@ flush_tx:
 			int found = 0;
 
 			kring = &na->tx_rings[i];
-			if (!want_tx && kring->ring->cur == kring->nr_hwcur)
+			if (pending_tx) {
+				if (!nm_pending_grab(na->tx_pending, i) &&
+				    kring->ring->cur == kring->nr_hwcur)
+					continue;
+			} else if (!want_tx && kring->ring->cur == kring->nr_hwcur)
 				continue;
 			/* only one thread does txsync */
 			if (nm_kr_tryget(kring)) {
+				if (pending_tx) /* keep it for the next round */
+					nm_notify_pending(na, i, NR_TX);
 				/* either busy or stopped
 				 * XXX if the ring is stopped, sleeping would
 				 * be better. In current code, however, we only
@@ -2405,6 +2861,8 @@ flush_tx:
 					    priv, i);
 				continue;
 			}
+			if (NM_LAT_ON(na))
+				t0 = NM_CYCLES();
 			if (nm_txsync_prologue(kring) >= kring->nkr_num_slots) {
 				netmap_ring_reinit(kring);
 				revents |= POLLERR;
@@ -2412,6 +2870,10 @@ flush_tx:
 				if (kring->nm_sync(kring, 0))
 					revents |= POLLERR;
 			}
+			if (t0) {
+				nm_lat_poll(na, kring, NM_LAT_TXSYNC, t0);
+				t0 = 0;
+			}
 
 			/*
 			 * If we found new slots, notify potential
@@ -2431,6 +2893,7 @@ flush_tx:
 			OS_selrecord(td, check_all_tx ?
 			    &na->tx_si : &na->tx_rings[priv->np_txqfirst].si);
 			retry_tx = 0;
+			pending_tx = 0;
 			goto flush_tx;
 		}
 	}
@@ -2448,7 +2911,13 @@ do_retry_rx:
 
 			kring = &na->rx_rings[i];
 
+			if (pending_rx && !nm_pending_grab(na->rx_pending, i) &&
+			    kring->ring->head == kring->nr_hwcur)
+				continue;
+
 			if (nm_kr_tryget(kring)) {
+				if (pending_rx)
+					nm_notify_pending(na, i, NR_RX);
 				if (netmap_verbose)
 					RD(2, "%p lost race on rxring %d, ok",
 					    priv, i);
@@ -2467,8 +2936,14 @@ do_retry_rx:
 				netmap_grab_packets(kring, &q, netmap_fwd);
 			}
 
+			if (NM_LAT_ON(na))
+				t0 = NM_CYCLES();
 			if (kring->nm_sync(kring, 0))
 				revents |= POLLERR;
+			if (t0) {
+				nm_lat_poll(na, kring, NM_LAT_RXSYNC, t0);
+				t0 = 0;
+			}
 			if (netmap_no_timestamp == 0 ||
 					kring->ring->flags & NR_TIMESTAMP) {
 				microtime(&kring->ring->ts);
@@ -2501,6 +2976,7 @@ do_retry_rx:
 			    &na->rx_si : &na->rx_rings[priv->np_rxqfirst].si);
 		if (send_down > 0 || retry_rx) {
 			retry_rx = 0;
+			pending_rx = 0;
 			if (send_down)
 				goto flush_tx; /* and retry_rx */
 			else
@@ -2538,21 +3014,29 @@ netmap_notify(struct netmap_adapter *na, u_int n_ring,
 {
 	struct netmap_kring *kring;
 
+	kring = (tx == NR_TX) ? na->tx_rings + n_ring : na->rx_rings + n_ring;
+	if (netmap_stats && kring->ring)
+		NM_ATOMIC_ADD64(&NETMAP_RING_STATS(kring->ring)->notifies, 1);
+	if (NM_LAT_ON(na) && kring->nkr_notify_cycles == 0)
+		kring->nkr_notify_cycles = NM_CYCLES();
+
 	if (tx == NR_TX) {
-		kring = na->tx_rings + n_ring;
 		OS_selwakeup(&kring->si, PI_NET);
 		/* optimization: avoid a wake up on the global
 		 * queue if nobody has registered for more
 		 * than one ring
 		 */
-		if (na->tx_si_users > 0)
+		if (na->tx_si_users > 0) {
+			nm_notify_pending(na, n_ring, NR_TX);
 			OS_selwakeup(&na->tx_si, PI_NET);
+		}
 	} else {
-		kring = na->rx_rings + n_ring;
 		OS_selwakeup(&kring->si, PI_NET);
 		/* optimization: same as above */
-		if (na->rx_si_users > 0)
+		if (na->rx_si_users > 0) {
+			nm_notify_pending(na, n_ring, NR_RX);
 			OS_selwakeup(&na->rx_si, PI_NET);
+		}
 	}
 	return 0;
 }
@@ -2838,32 +3322,30 @@ netmap_transmit(struct ifnet *ifp, struct mbuf *m)
 	if (len > NETMAP_BUF_SIZE(na)) { /* too long for us */
 		D("%s from_host, drop packet size %d > %d", na->name,
 			len, NETMAP_BUF_SIZE(na));
+		nm_kr_stats_drop(kring, NR_DROP_TOO_LONG, 1);
 		goto done;
 	}
 
-	/* protect against rxsync_from_host(), netmap_sw_to_nic()
-	 * and maybe other instances of netmap_transmit (the latter
-	 * not possible on Linux).
-	 * Also avoid overflowing the queue.
+	/* The inbox of q is lock-free, so we do not serialize against
+	 * rxsync_from_host() or other instances of netmap_transmit.
+	 * Avoid overflowing the queue; the check is racy, but the
+	 * excess only waits in the queue for the next rxsync.
 	 */
-	mbq_lock(q);
-
         space = kring->nr_hwtail - kring->nr_hwcur;
         if (space < 0)
                 space += kring->nkr_num_slots;
-	if (space + mbq_len(q) >= kring->nkr_num_slots - 1) { // XXX
+	if (space + mbq_mp_len(q) >= kring->nkr_num_slots - 1) { // XXX
 		RD(10, "%s full hwcur %d hwtail %d qlen %d len %d m %p",
-			na->name, kring->nr_hwcur, kring->nr_hwtail, mbq_len(q),
+			na->name, kring->nr_hwcur, kring->nr_hwtail, mbq_mp_len(q),
 			len, m);
+		nm_kr_stats_drop(kring, NR_DROP_RING_FULL, 1);
 	} else {
-		mbq_enqueue(q, m);
+		mbq_mp_enqueue(q, m);
 		ND(10, "%s %d bufs in queue len %d m %p",
-			na->name, mbq_len(q), len, m);
-		/* notify outside the lock */
+			na->name, mbq_mp_len(q), len, m);
 		m = NULL;
 		error = 0;
 	}
-	mbq_unlock(q);
 
 done:
 	if (m)
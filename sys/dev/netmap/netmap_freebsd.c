@@ -33,6 +33,9 @@
 #include <sys/kernel.h> /* types used in module initialization */
 #include <sys/conf.h>	/* DEV_MODULE */
 #include <sys/endian.h>
+#include <sys/capsicum.h> /* cap_rights_init() */
+#include <sys/file.h>	/* fget(), fdrop() */
+#include <sys/vnode.h>	/* struct vnode, VCHR */
 
 #include <sys/rwlock.h>
 
@@ -197,11 +200,12 @@ netmap_catch_tx(struct netmap_generic_adapter *gna, int enable)
 /*
  * Transmit routine used by generic_netmap_txsync(). Returns 0 on success
  * and non-zero on error (which may be packet drops or other errors).
- * addr and len identify the netmap buffer, m is the (preallocated)
- * mbuf to use for transmissions.
+ * The frame is in the nfrags slots of kring starting at first,
+ * m is the (preallocated) mbuf to use for transmissions.
  *
  * We should add a reference to the mbuf so the m_freem() at the end
  * of the transmission does not consume resources.
+ * The flags are ignored: if_transmit() already goes straight to the driver.
  *
  * On FreeBSD, and on multiqueue cards, we can force the queue using
  *      if ((m->m_flags & M_FLOWID) != 0)
@@ -212,8 +216,13 @@ netmap_catch_tx(struct netmap_generic_adapter *gna, int enable)
  */
 int
 generic_xmit_frame(struct ifnet *ifp, struct mbuf *m,
-	void *addr, u_int len, u_int ring_nr)
+	struct netmap_kring *kring, u_int first, u_int nfrags, int flags)
 {
+	struct netmap_adapter *na = kring->na;
+	struct netmap_ring *ring = kring->ring;
+	u_int const lim = kring->nkr_num_slots - 1;
+	u_int ring_nr = kring->ring_id;
+	u_int nm_i, i, tot = 0;
 	int ret;
 
 	/*
@@ -223,21 +232,25 @@ generic_xmit_frame(struct ifnet *ifp, struct mbuf *m,
 	 */
 
 	if (GET_MBUF_REFCNT(m) != 1) {
-		D("invalid refcnt %d for %p",
-			GET_MBUF_REFCNT(m), m);
-		panic("in generic_xmit_frame");
-	}
-	// XXX the ext_size check is unnecessary if we link the netmap buf
-	if (m->m_ext.ext_size < len) {
-		RD(5, "size %d < len %d", m->m_ext.ext_size, len);
-		len = m->m_ext.ext_size;
+		/* completed out of order, still owned by the driver */
+		RD(5, "busy refcnt %d for %p", GET_MBUF_REFCNT(m), m);
+		return EBUSY;
 	}
-	if (0) { /* XXX seems to have negligible benefits */
-		m->m_ext.ext_buf = m->m_data = addr;
-	} else {
-		bcopy(addr, m->m_data, len);
+	for (nm_i = first, i = 0; i < nfrags; i++, nm_i = nm_next(nm_i, lim))
+		tot += ring->slot[nm_i].len;
+	if (tot > m->m_ext.ext_size)
+		return GENERIC_XMIT_DROP; /* does not fit in the mbuf */
+	tot = 0;
+	for (nm_i = first; nfrags > 0; nfrags--, nm_i = nm_next(nm_i, lim)) {
+		struct netmap_slot *slot = &ring->slot[nm_i];
+		u_int len = slot->len;
+		void *addr = NMB(na, slot);
+
+		NM_CHECK_ADDR_LEN(na, addr, len);
+		bcopy(addr, m->m_data + tot, len);
+		tot += len;
 	}
-	m->m_len = m->m_pkthdr.len = len;
+	m->m_len = m->m_pkthdr.len = tot;
 	// inc refcount. All ours, we could skip the atomic
 	atomic_fetchadd_int(PNT_MBUF_REFCNT(m), 1);
 	m->m_flags |= M_FLOWID;
@@ -800,6 +813,48 @@ struct cdevsw netmap_cdevsw = {
 };
 /*--- end of kqueue support ----*/
 
+/*
+ * fd -> netmap priv, for NIOCSYNCV.
+ * devfs_get_cdevpriv() works on the file of the current operation
+ * (td->td_fpop), so we temporarily point it to the target file.
+ */
+int
+netmap_fd_getpriv(int fd, struct thread *td,
+	struct netmap_priv_d **priv, void **cookie)
+{
+	struct file *fp, *saved_fp;
+	cap_rights_t rights;
+	struct vnode *vp;
+	int error;
+
+	error = fget(td, fd, cap_rights_init(&rights, CAP_IOCTL), &fp);
+	if (error)
+		return error;
+	vp = fp->f_vnode;
+	if (fp->f_type != DTYPE_VNODE || vp == NULL || vp->v_type != VCHR ||
+	    vp->v_rdev == NULL || vp->v_rdev->si_devsw != &netmap_cdevsw) {
+		fdrop(fp, td);
+		return EBADF;
+	}
+	saved_fp = td->td_fpop;
+	td->td_fpop = fp;
+	error = devfs_get_cdevpriv((void **)priv);
+	td->td_fpop = saved_fp;
+	if (error) {
+		fdrop(fp, td);
+		return (error == ENOENT ? ENXIO : error);
+	}
+	*cookie = fp;
+	return 0;
+}
+
+
+void
+netmap_fd_putpriv(void *cookie, struct thread *td)
+{
+	fdrop((struct file *)cookie, td);
+}
+
 /*
  * Kernel entry point.
  *
@@ -111,6 +111,7 @@ __FBSDID("$FreeBSD: head/sys/dev/netmap/netmap_generic.c 274353 2014-11-10 20:19
 	(m)->m_ext.ext_free = (void *)fn;	\
 	(m)->m_ext.ext_type = EXT_EXTREF;	\
 } while (0)
+#define MBUF_DESTRUCTOR_ARG(m)	((m)->m_ext.ext_arg2)
 
 static void
 netmap_default_mbuf_destructor(struct mbuf *m)
@@ -240,6 +241,18 @@ netmap_generic_irq(struct ifnet *ifp, u_int q, u_int *work_done)
 }
 
 
+/*
+ * Base size of the backlog of mbufs queued to an rx ring,
+ * generic_rx_backlog or the number of slots of the ring.
+ */
+static inline u_int
+generic_rx_backlog(struct netmap_kring *kring)
+{
+	return netmap_generic_rx_backlog > 0 ?
+		netmap_generic_rx_backlog : kring->nkr_num_slots;
+}
+
+
 /* Enable/disable netmap mode for a generic network interface. */
 static int
 generic_netmap_register(struct netmap_adapter *na, int enable)
@@ -276,6 +289,9 @@ generic_netmap_register(struct netmap_adapter *na, int enable)
 		 */
 		for (r=0; r<na->num_rx_rings; r++) {
 			mbq_safe_init(&na->rx_rings[r].rx_queue);
+			mbq_init(&na->rx_rings[r].rx_batch);
+			na->rx_rings[r].nkr_backlog =
+				generic_rx_backlog(&na->rx_rings[r]);
 		}
 
 		/*
@@ -293,6 +309,11 @@ generic_netmap_register(struct netmap_adapter *na, int enable)
 			}
 			for (i=0; i<na->num_tx_desc; i++)
 				na->tx_rings[r].tx_pool[i] = NULL;
+			na->tx_rings[r].nkr_tx_reclaimed = 0;
+			na->tx_rings[r].nkr_tx_done = 0;
+			na->tx_rings[r].nkr_tx_pending = 0;
+			na->tx_rings[r].nkr_tx_event_mbuf = NULL;
+			na->tx_rings[r].nkr_tx_zcopy = 0;
 			for (i=0; i<na->num_tx_desc; i++) {
 				m = netmap_get_mbuf(NETMAP_BUF_SIZE(na));
 				if (!m) {
@@ -350,6 +371,8 @@ generic_netmap_register(struct netmap_adapter *na, int enable)
 		for (r=0; r<na->num_rx_rings; r++) {
 			mbq_safe_purge(&na->rx_rings[r].rx_queue);
 			mbq_safe_destroy(&na->rx_rings[r].rx_queue);
+			mbq_purge(&na->rx_rings[r].rx_batch);
+			mbq_destroy(&na->rx_rings[r].rx_batch);
 		}
 
 		for (r=0; r<na->num_rx_rings; r++)
@@ -395,6 +418,7 @@ free_tx_pools:
 	for (r=0; r<na->num_rx_rings; r++) {
 		netmap_mitigation_cleanup(&gna->mit[r]);
 		mbq_safe_destroy(&na->rx_rings[r].rx_queue);
+		mbq_destroy(&na->rx_rings[r].rx_batch);
 	}
 	free(gna->mit, M_DEVBUF);
 out:
@@ -406,14 +430,38 @@ out:
  * Callback invoked when the device driver frees an mbuf used
  * by netmap to transmit a packet. This usually happens when
  * the NIC notifies the driver that transmission is completed.
+ * The device and the queue of the mbuf may have been rewritten
+ * on the way (veth, forwarding), so the adapter is the one
+ * recorded by generic_set_tx_event(), and the ring the one whose
+ * event is m. The krings are only looked at while netmap is on,
+ * as they go away when the adapter is unregistered.
  */
 static void
 generic_mbuf_destructor(struct mbuf *m)
 {
-	netmap_generic_irq(MBUF_IFP(m), MBUF_TXQ(m), NULL);
+	struct netmap_adapter *na = MBUF_DESTRUCTOR_ARG(m);
+	u_int q;
+
+	MBUF_DESTRUCTOR_ARG(m) = NULL;
+	if (unlikely(na == NULL || !nm_netmap_on(na)))
+		goto out;
+	for (q = 0; q < na->num_tx_rings; q++) {
+		struct netmap_kring *kring = &na->tx_rings[q];
+
+		if (kring->nkr_tx_event_mbuf != m)
+			continue;
+		kring->nkr_tx_event_mbuf = NULL;
+		/* publish the completion before allowing a new event */
+		kring->nkr_tx_done = kring->nkr_tx_event;
+		wmb();
+		kring->nkr_tx_pending = 0;
+		netmap_generic_irq(na->ifp, q, NULL);
+		break;
+	}
+out:
 #ifdef __FreeBSD__
 	if (netmap_verbose)
-		RD(5, "Tx irq (%p) queue %d index %d" , m, MBUF_TXQ(m), (int)(uintptr_t)m->m_ext.ext_arg1);
+		RD(5, "Tx irq (%p) index %d" , m, (int)(uintptr_t)m->m_ext.ext_arg1);
 	netmap_default_mbuf_destructor(m);
 #endif /* __FreeBSD__ */
 	IFRATE(rate_ctx.new.txirq++);
@@ -425,28 +473,57 @@ extern int netmap_adaptive_io;
  *
  * The oldest tx buffer not yet completed is at nr_hwtail + 1,
  * nr_hwcur is the first unsent buffer.
+ * Completions are learnt from nkr_tx_done, which the destructor
+ * of the event mbuf moves past the event slot. This assumes that
+ * the driver completes the transmissions of a queue in order, and
+ * costs O(1) whatever the number of buffers in flight.
+ * With scan set we also walk the following buffers and check their
+ * refcounts, as done before.
+ * Zero-copy frames hold the netmap buffers until their own mbuf is
+ * released, which may happen after the event even with in-order
+ * drivers (e.g. veth), so while they may be in flight every slot
+ * is checked and the event is only used as a wakeup.
  */
 static u_int
-generic_netmap_tx_clean(struct netmap_kring *kring)
+generic_netmap_tx_clean(struct netmap_kring *kring, int scan)
 {
 	u_int const lim = kring->nkr_num_slots - 1;
 	u_int nm_i = nm_next(kring->nr_hwtail, lim);
 	u_int hwcur = kring->nr_hwcur;
-	u_int n = 0;
+	u_int n, busy;
 	struct mbuf **tx_pool = kring->tx_pool;
 
-	while (nm_i != hwcur) { /* buffers not completed */
+	busy = (hwcur + lim + 1 - nm_i) % (lim + 1);
+	rmb();
+	n = kring->nkr_tx_done - kring->nkr_tx_reclaimed;
+	if (n > busy)
+		n = 0; /* a stale value, we are past it */
+	if (kring->nkr_tx_zcopy) {
+		n = 0;
+		scan = 1;
+	}
+	if (n) {
+		nm_i = (nm_i + n) % (lim + 1);
+		/* the event slot gave its mbuf to the destructor */
+		if (tx_pool[nm_prev(nm_i, lim)] == NULL)
+			tx_pool[nm_prev(nm_i, lim)] =
+				netmap_get_mbuf(NETMAP_BUF_SIZE(kring->na));
+	}
+
+	while (scan && nm_i != hwcur) { /* buffers not completed */
 		struct mbuf *m = tx_pool[nm_i];
 
 		if (unlikely(m == NULL)) {
+			if (kring->nkr_tx_pending && kring->nkr_tx_event ==
+					kring->nkr_tx_reclaimed + n + 1)
+				break; /* the event mbuf is in flight */
 			/* this is done, try to replenish the entry */
 			tx_pool[nm_i] = m = netmap_get_mbuf(NETMAP_BUF_SIZE(kring->na));
 			if (unlikely(m == NULL)) {
 				D("mbuf allocation failed, XXX error");
-				// XXX how do we proceed ? break ?
-				return -ENOMEM;
+				break;
 			}
-		} else if (GET_MBUF_REFCNT(m) != 1) {
+		} else if (GET_MBUF_REFCNT(m) != 1 || MBUF_SHARED(m)) {
 			break; /* This mbuf is still busy: its refcnt is 2. */
 		}
 		n++;
@@ -469,6 +546,7 @@ generic_netmap_tx_clean(struct netmap_kring *kring)
 		}
 #endif
 	}
+	kring->nkr_tx_reclaimed += n;
 	kring->nr_hwtail = nm_prev(nm_i, lim);
 	ND("tx completed [%d] -> hwtail %d", n, kring->nr_hwtail);
 
@@ -515,12 +593,29 @@ static void
 generic_set_tx_event(struct netmap_kring *kring, u_int hwcur)
 {
 	struct mbuf *m;
+	u_int const lim = kring->nkr_num_slots - 1;
+	u_int ntc = nm_next(kring->nr_hwtail, lim);
 	u_int e;
 
-	if (nm_next(kring->nr_hwtail, kring->nkr_num_slots -1) == hwcur) {
+	if (ntc == hwcur) {
 		return; /* all buffers are free */
 	}
+	if (kring->nkr_tx_pending) {
+		return; /* one at a time, see generic_mbuf_destructor() */
+	}
 	e = generic_tx_event_middle(kring, hwcur);
+	/* With adaptive mitigation, also bound the number of completions
+	 * we wait for.
+	 */
+	if (netmap_generic_mit_adaptive && netmap_generic_mit_batch > 0 &&
+	    (e + lim + 1 - ntc) % (lim + 1) > (u_int)netmap_generic_mit_batch)
+		e = (ntc + netmap_generic_mit_batch - 1) % (lim + 1);
+	/* The mbufs of NS_MOREFRAG continuation slots are not in flight,
+	 * the event must go on the first slot of the frame.
+	 */
+	while (e != ntc && (m = kring->tx_pool[e]) != NULL &&
+			GET_MBUF_REFCNT(m) == 1)
+		e = nm_prev(e, lim);
 
 	m = kring->tx_pool[e];
 	ND(5, "Request Event at %d mbuf %p refcnt %d", e, m, m ? GET_MBUF_REFCNT(m) : -2 );
@@ -530,21 +625,96 @@ generic_set_tx_event(struct netmap_kring *kring, u_int hwcur)
 		return;
 	}
 	kring->tx_pool[e] = NULL;
+	kring->nkr_tx_event = kring->nkr_tx_reclaimed +
+		(e + lim + 1 - ntc) % (lim + 1) + 1;
+	kring->nkr_tx_pending = 1;
+	kring->nkr_tx_event_mbuf = m;
+	MBUF_DESTRUCTOR_ARG(m) = kring->na;
 	SET_MBUF_DESTRUCTOR(m, generic_mbuf_destructor);
 
-	// XXX wmb() ?
+	wmb();
 	/* Decrement the refcount an free it if we have the last one. */
 	m_freem(m);
 	smp_mb();
 }
 
 
+/*
+ * Return the number of slots of the frame starting at nm_i, which
+ * ends at the first slot without NS_MOREFRAG, and the index of the
+ * slot after it in *next. Return 0 if the frame is not complete
+ * before head.
+ */
+static inline u_int
+generic_tx_frame(struct netmap_kring *kring, u_int nm_i, u_int head,
+	u_int *next)
+{
+	struct netmap_ring *ring = kring->ring;
+	u_int const lim = kring->nkr_num_slots - 1;
+	u_int n = 1;
+
+	if (nm_i == head)
+		return 0;
+	while (ring->slot[nm_i].flags & NS_MOREFRAG) {
+		nm_i = nm_next(nm_i, lim);
+		if (nm_i == head)
+			return 0;
+		n++;
+	}
+	*next = nm_next(nm_i, lim);
+	return n;
+}
+
+/*
+ * Copy the user buffers of the NS_INDIRECT slots of a frame into the
+ * netmap buffers of the slots, which are then sent as usual.
+ * copyin() may sleep, so we release the tx queue meanwhile.
+ */
+static int
+generic_tx_indirect(struct netmap_kring *kring, u_int nm_i, u_int n,
+	int xflags)
+{
+	struct netmap_adapter *na = kring->na;
+	struct netmap_ring *ring = kring->ring;
+	u_int const lim = kring->nkr_num_slots - 1;
+	int unlocked = 0, error = 0;
+
+	for (; n > 0; n--, nm_i = nm_next(nm_i, lim)) {
+		struct netmap_slot *slot = &ring->slot[nm_i];
+		u_int len = slot->len;
+		void *addr = NMB(na, slot);
+
+		if (likely(!(slot->flags & NS_INDIRECT)))
+			continue;
+		NM_CHECK_ADDR_LEN(na, addr, len);
+		if ((xflags & GENERIC_XMIT_DIRECT) && !unlocked) {
+			generic_xmit_unlock(na->ifp, kring->ring_id);
+			unlocked = 1;
+		}
+		error = copyin((void *)(uintptr_t)slot->ptr, addr, len);
+		if (error)
+			break;
+	}
+	if (unlocked)
+		generic_xmit_lock(na->ifp, kring->ring_id);
+	return error;
+}
+
 /*
  * generic_netmap_txsync() transforms netmap buffers into mbufs
  * and passes them to the standard device driver
  * (ndo_start_xmit() or ifp->if_transmit() ).
- * On linux this is not done directly, but using dev_queue_xmit(),
- * since it implements the TX flow control (and takes some locks).
+ * On linux the whole batch goes directly to ndo_start_xmit() with
+ * the tx queue locked once, and all frames but the last one marked
+ * with xmit_more so that the driver can defer the doorbell.
+ * Flow control comes from the stopped state of the queue.
+ * dev_queue_xmit() is used instead if generic_txqdisc is set.
+ *
+ * A frame made of several slots (NS_MOREFRAG) uses the mbuf of
+ * its first slot. generic_xmit_frame() may attach the netmap
+ * buffers to the mbuf instead of copying them, which is safe
+ * because the slots go back to the user only when the driver
+ * has released the mbuf.
  */
 static int
 generic_netmap_txsync(struct netmap_kring *kring, int flags)
@@ -556,6 +726,8 @@ generic_netmap_txsync(struct netmap_kring *kring, int flags)
 	u_int const lim = kring->nkr_num_slots - 1;
 	u_int const head = kring->rhead;
 	u_int ring_nr = kring->ring_id;
+	u_int next, nfrags;
+	int xflags = netmap_generic_txqdisc ? 0 : GENERIC_XMIT_DIRECT;
 
 	IFRATE(rate_ctx.new.txsync++);
 
@@ -567,19 +739,17 @@ generic_netmap_txsync(struct netmap_kring *kring, int flags)
 	 * First part: process new packets to send.
 	 */
 	nm_i = kring->nr_hwcur;
-	if (nm_i != head) {	/* we have new packets to send */
-		while (nm_i != head) {
-			struct netmap_slot *slot = &ring->slot[nm_i];
-			u_int len = slot->len;
-			void *addr = NMB(na, slot);
-
+	nfrags = generic_tx_frame(kring, nm_i, head, &next);
+	if (nfrags) {	/* we have new packets to send */
+		if (xflags & GENERIC_XMIT_DIRECT)
+			generic_xmit_lock(ifp, ring_nr);
+		while (nfrags) {
 			/* device-specific */
 			struct mbuf *m;
+			u_int nnext, n, j;
 			int tx_ret;
 
-			NM_CHECK_ADDR_LEN(na, addr, len);
-
-			/* Tale a mbuf from the tx pool and copy in the user packet. */
+			/* Take a mbuf from the tx pool for the user packet. */
 			m = kring->tx_pool[nm_i];
 			if (unlikely(!m)) {
 				RD(5, "This should never happen");
@@ -589,6 +759,11 @@ generic_netmap_txsync(struct netmap_kring *kring, int flags)
 					break;
 				}
 			}
+			if (unlikely(generic_tx_indirect(kring, nm_i, nfrags, xflags))) {
+				RD(5, "bad indirect buffer, frame at slot %u dropped", nm_i);
+				nm_kr_stats_drop(kring, NR_DROP_BAD_SLOT, 1);
+				goto next_frame;
+			}
 			/* XXX we should ask notifications when NS_REPORT is set,
 			 * or roughly every half frame. We can optimize this
 			 * by lazily requesting notifications only when a
@@ -596,7 +771,23 @@ generic_netmap_txsync(struct netmap_kring *kring, int flags)
 			 * break on failures and set notifications when
 			 * ring->cur == ring->tail || nm_i != cur
 			 */
-			tx_ret = generic_xmit_frame(ifp, m, addr, len, ring_nr);
+			/* Defer the doorbell only if the next frame is
+			 * certainly going to be sent in this batch: if it
+			 * failed or was dropped, nobody would ring it.
+			 * MORE only matters on the direct path.
+			 */
+			n = generic_tx_frame(kring, next, head, &nnext);
+			if ((xflags & GENERIC_XMIT_DIRECT) && n &&
+					generic_xmit_ready(ifp, kring, next, n, xflags))
+				xflags |= GENERIC_XMIT_MORE;
+			else
+				xflags &= ~GENERIC_XMIT_MORE;
+			tx_ret = generic_xmit_frame(ifp, m, kring, nm_i, nfrags, xflags);
+			if (unlikely(tx_ret == GENERIC_XMIT_DROP)) {
+				RD(5, "frame at slot %u too long, dropped", nm_i);
+				nm_kr_stats_drop(kring, NR_DROP_TOO_LONG, 1);
+				goto next_frame;
+			}
 			if (unlikely(tx_ret)) {
 				ND(5, "start_xmit failed: err %d [nm_i %u, head %u, hwtail %u]",
 						tx_ret, nm_i, head, kring->nr_hwtail);
@@ -615,35 +806,39 @@ generic_netmap_txsync(struct netmap_kring *kring, int flags)
 				 * and we solve it there by dropping the excess packets.
 				 */
 				generic_set_tx_event(kring, nm_i);
-				if (generic_netmap_tx_clean(kring)) { /* space now available */
+				if (generic_netmap_tx_clean(kring, 1)) { /* space now available */
 					continue;
 				} else {
 					break;
 				}
 			}
-			slot->flags &= ~(NS_REPORT | NS_BUF_CHANGED);
-			nm_i = nm_next(nm_i, lim);
 			IFRATE(rate_ctx.new.txpkt ++);
+next_frame:
+			for (j = nm_i; j != next; j = nm_next(j, lim))
+				ring->slot[j].flags &= ~(NS_REPORT | NS_BUF_CHANGED);
+			nm_i = next;
+			nfrags = generic_tx_frame(kring, nm_i, head, &next);
 		}
+		if (xflags & GENERIC_XMIT_DIRECT)
+			generic_xmit_unlock(ifp, ring_nr);
 
 		/* Update hwcur to the next slot to transmit. */
 		kring->nr_hwcur = nm_i; /* not head, we could break early */
 	}
 
 	/*
-	 * Second, reclaim completed buffers
+	 * Second, reclaim completed buffers.
+	 * Keep an event outstanding while there are buffers in flight,
+	 * so that completions keep flowing into nkr_tx_done.
+	 * No doublecheck is performed, since txsync() will be
+	 * called twice by netmap_poll().
 	 */
-	if (flags & NAF_FORCE_RECLAIM || nm_kr_txempty(kring)) {
-		/* No more available slots? Set a notification event
-		 * on a netmap slot that will be cleaned in the future.
-		 * No doublecheck is performed, since txsync() will be
-		 * called twice by netmap_poll().
-		 */
-		generic_set_tx_event(kring, nm_i);
-	}
+	generic_set_tx_event(kring, nm_i);
 	ND("tx #%d, hwtail = %d", n, kring->nr_hwtail);
 
-	generic_netmap_tx_clean(kring);
+	generic_netmap_tx_clean(kring, flags & NAF_FORCE_RECLAIM);
+	if (kring->nr_hwtail == nm_prev(kring->nr_hwcur, lim))
+		kring->nkr_tx_zcopy = 0; /* nothing in flight */
 
 	nm_txsync_finalize(kring);
 
@@ -652,33 +847,193 @@ generic_netmap_txsync(struct netmap_kring *kring, int flags)
 
 
 /*
- * This handler is registered (through netmap_catch_rx())
- * within the attached network interface
- * in the RX subsystem, so that every mbuf passed up by
- * the driver can be stolen to the network stack.
- * Stolen packets are put in a queue where the
- * generic_netmap_rxsync() callback can extract them.
+ * Software rss (NM_CFG_RSS).
+ * The default key repeats a 16 bit pattern, which makes the Toeplitz
+ * hash symmetric with respect to swapping addresses and ports.
  */
-void
-generic_rx_handler(struct ifnet *ifp, struct mbuf *m)
+static const uint8_t generic_rss_default_key[NM_RSS_KEY_LEN] = {
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+};
+
+static void
+generic_rss_init(struct netmap_generic_adapter *gna)
+{
+	u_int i;
+
+	memcpy(gna->rss.key, generic_rss_default_key, NM_RSS_KEY_LEN);
+	for (i = 0; i < NM_RSS_TABLE_SIZE; i++)
+		gna->rss.table[i] = i % gna->up.up.num_rx_rings;
+}
+
+/* Toeplitz hash of len bytes (at most NM_RSS_KEY_LEN - 4). */
+static uint32_t
+generic_toeplitz(const uint8_t *key, const uint8_t *data, u_int len)
+{
+	uint32_t hash = 0;
+	uint32_t v = (key[0] << 24) | (key[1] << 16) | (key[2] << 8) | key[3];
+	u_int i, b;
+
+	for (i = 0; i < len; i++) {
+		for (b = 0; b < 8; b++) {
+			if (data[i] & (0x80 >> b))
+				hash ^= v;
+			v <<= 1;
+			if (key[i + 4] & (0x80 >> b))
+				v |= 1;
+		}
+	}
+	return hash;
+}
+
+/*
+ * Toeplitz hash of the frame at buf, which has at least len contiguous
+ * bytes, with the default (symmetric) key if key is NULL.
+ * Frames that are not IPv4/IPv6 hash to 0. Only the addresses are
+ * hashed for IP fragments and other protocols.
+ * Also used by the pipe groups.
+ */
+uint32_t
+nm_rss_hash(const uint8_t *key, const uint8_t *buf, u_int len)
+{
+	uint8_t tuple[36];	/* addresses and ports, at most IPv6 */
+	u_int off = 14, n = 0, proto = 0, l4 = 0;
+	uint16_t type;
+
+	if (len < 14)
+		goto out;
+	type = (buf[12] << 8) | buf[13];
+	if (type == 0x8100 && len >= 18) {	/* 802.1Q */
+		type = (buf[16] << 8) | buf[17];
+		off += 4;
+	}
+	if (type == 0x0800 && len >= off + 20) {
+		const uint8_t *ip = buf + off;
+
+		memcpy(tuple, ip + 12, 8);
+		n = 8;
+		/* ports only if this is not a fragment */
+		if ((((ip[6] << 8) | ip[7]) & 0x3fff) == 0) {
+			proto = ip[9];
+			l4 = off + (ip[0] & 0xf) * 4;
+		}
+	} else if (type == 0x86dd && len >= off + 40) {
+		const uint8_t *ip = buf + off;
+
+		memcpy(tuple, ip + 8, 32);
+		n = 32;
+		proto = ip[6];	/* no extension headers */
+		l4 = off + 40;
+	}
+	if ((proto == 6 || proto == 17) && len >= l4 + 4) {	/* TCP, UDP */
+		memcpy(tuple + n, buf + l4, 4);
+		n += 4;
+	}
+out:
+	return generic_toeplitz(key ? key : generic_rss_default_key, tuple, n);
+}
+
+/* Return the rx ring for the frame at buf. */
+static inline u_int
+generic_rss_ring(struct netmap_generic_adapter *gna, const uint8_t *buf,
+	u_int len)
+{
+	return gna->rss.table[nm_rss_hash(gna->rss.key, buf, len) %
+		NM_RSS_TABLE_SIZE];
+}
+
+/*
+ * Pick the rx ring for a frame received on hardware queue hwq.
+ */
+static inline u_int
+generic_rx_ring(struct netmap_adapter *na, u_int hwq, const void *buf,
+	u_int len)
+{
+	if (netmap_generic_rss && na->num_rx_rings > 1)
+		return generic_rss_ring((struct netmap_generic_adapter *)na,
+			buf, len);
+	if (hwq >= na->num_rx_rings) {
+		hwq = hwq % na->num_rx_rings; // XXX expensive...
+	}
+	return hwq;
+}
+
+/*
+ * NM_CFG_RSS: report, and with NM_RSS_SET replace, key and table.
+ */
+int
+generic_rss_config(struct netmap_adapter *na, struct nm_rss_req *req)
 {
-	struct netmap_adapter *na = NA(ifp);
 	struct netmap_generic_adapter *gna = (struct netmap_generic_adapter *)na;
-	u_int work_done;
-	u_int rr = MBUF_RXQ(m); // receive ring number
+	u_int i;
 
-	if (rr >= na->num_rx_rings) {
-		rr = rr % na->num_rx_rings; // XXX expensive...
+	if (req->nrs_flags & NM_RSS_SET) {
+		for (i = 0; i < NM_RSS_TABLE_SIZE; i++) {
+			if (req->nrs_table[i] >= na->num_rx_rings)
+				return EINVAL;
+		}
+		memcpy(gna->rss.key, req->nrs_key, NM_RSS_KEY_LEN);
+		memcpy(gna->rss.table, req->nrs_table, NM_RSS_TABLE_SIZE);
 	}
+	memcpy(req->nrs_key, gna->rss.key, NM_RSS_KEY_LEN);
+	memcpy(req->nrs_table, gna->rss.table, NM_RSS_TABLE_SIZE);
+	req->nrs_rings = na->num_rx_rings;
+	return 0;
+}
 
-	/* limit the size of the queue */
-	if (unlikely(mbq_len(&na->rx_rings[rr].rx_queue) > 1024)) {
-		m_freem(m);
-	} else {
-		mbq_safe_enqueue(&na->rx_rings[rr].rx_queue, m);
+/* shortest adaptive mitigation interval, in nanoseconds */
+#define GENERIC_MIT_MIN		2000
+
+/*
+ * Compute the next mitigation interval of mit. Called by the
+ * platform code when the timer expires, with mit_count packets
+ * received during the interval.
+ * With dev.netmap.generic_mit_adaptive the interval tracks the
+ * packet rate so that a notification carries about
+ * generic_mit_batch packets, but it never exceeds
+ * generic_mit_latency ns. When the consumer is not draining the
+ * ring (more than half full), waking it up more often is pointless,
+ * so the interval is not reduced.
+ * Otherwise the interval is the fixed generic_mit.
+ */
+void
+generic_mit_adapt(struct nm_generic_mit *mit)
+{
+	struct netmap_kring *kring = &mit->mit_na->rx_rings[mit->mit_ring_idx];
+	u_int ival = mit->mit_interval;
+	u_int n = mit->mit_count;
+	uint64_t want;
+
+	mit->mit_count = 0;
+	if (!netmap_generic_mit_adaptive) {
+		mit->mit_interval = netmap_generic_mit;
+		return;
 	}
+	want = (uint64_t)(ival / (n ? n : 1)) * netmap_generic_mit_batch;
+	if (want < ival && nm_kr_rxspace(kring) > kring->nkr_num_slots / 2)
+		want = ival;
+	want = (ival + want) / 2;
+	ival = want > (u_int)netmap_generic_mit_latency ?
+		netmap_generic_mit_latency : want;
+	if (ival < GENERIC_MIT_MIN)
+		ival = GENERIC_MIT_MIN;
+	mit->mit_interval = ival;
+}
+
+/*
+ * Wake up the users of rx ring rr, subject to rx mitigation.
+ */
+static void
+generic_rx_notify(struct netmap_adapter *na, u_int rr)
+{
+	struct netmap_generic_adapter *gna = (struct netmap_generic_adapter *)na;
+	u_int work_done;
 
-	if (netmap_generic_mit < 32768) {
+	gna->mit[rr].mit_count++;
+	if (!netmap_generic_mit_adaptive && netmap_generic_mit < 32768) {
 		/* no rx mitigation, pass notification up */
 		netmap_generic_irq(na->ifp, rr, &work_done);
 		IFRATE(rate_ctx.new.rxirq++);
@@ -692,11 +1047,66 @@ generic_rx_handler(struct ifnet *ifp, struct mbuf *m)
 		} else {
 			netmap_generic_irq(na->ifp, rr, &work_done);
 			IFRATE(rate_ctx.new.rxirq++);
+			if (!netmap_generic_mit_adaptive)
+				gna->mit[rr].mit_interval = netmap_generic_mit;
+			gna->mit[rr].mit_count = 0;
 			netmap_mitigation_start(&gna->mit[rr]);
 		}
 	}
 }
 
+/*
+ * Return true if the backlog of the rx ring is full. In a burst
+ * the limit doubles, up to generic_rx_burst times the base size,
+ * and goes back to the base when rxsync has drained the queue.
+ * Concurrent handlers may race on nkr_backlog, which is harmless.
+ */
+static inline int
+generic_rx_backlog_full(struct netmap_kring *kring)
+{
+	u_int qlen = mbq_mp_len(&kring->rx_queue) + mbq_len(&kring->rx_batch);
+	u_int max;
+
+	if (likely(qlen < kring->nkr_backlog))
+		return 0;
+	max = generic_rx_backlog(kring);
+	if (netmap_generic_rx_burst > 1)
+		max *= netmap_generic_rx_burst;
+	if (kring->nkr_backlog >= max)
+		return 1;
+	kring->nkr_backlog = kring->nkr_backlog * 2 < max ?
+		kring->nkr_backlog * 2 : max;
+	return 0;
+}
+
+/*
+ * This handler is registered (through netmap_catch_rx())
+ * within the attached network interface
+ * in the RX subsystem, so that every mbuf passed up by
+ * the driver can be stolen to the network stack.
+ * Stolen packets are put in a queue where the
+ * generic_netmap_rxsync() callback can extract them.
+ */
+void
+generic_rx_handler(struct ifnet *ifp, struct mbuf *m)
+{
+	struct netmap_adapter *na = NA(ifp);
+	u_int rr; // receive ring number
+
+	rr = generic_rx_ring(na, MBUF_RXQ(m), MBUF_DATA(m), MBUF_HEADLEN(m));
+
+	/* limit the size of the queue, allowing for bursts */
+	if (unlikely(generic_rx_backlog_full(&na->rx_rings[rr]))) {
+		m_freem(m);
+		nm_kr_stats_drop(&na->rx_rings[rr], NR_DROP_BACKLOG, 1);
+	} else {
+		/* lock-free, handlers may run on several cpus */
+		mbq_mp_enqueue(&na->rx_rings[rr].rx_queue, m);
+	}
+
+	generic_rx_notify(na, rr);
+}
+
 /*
  * generic_netmap_rxsync() extracts mbufs from the queue filled by
  * generic_netmap_rx_handler() and puts their content in the netmap
@@ -726,6 +1136,17 @@ generic_netmap_rxsync(struct netmap_kring *kring, int flags)
 		 */
 		uint16_t slot_flags = kring->nkr_slot_flags;
 		u_int stop_i = nm_prev(kring->nr_hwcur, lim);
+		struct mbq *q = &kring->rx_batch;
+		struct mbq done;	/* copied, to be freed in one go */
+
+		/*
+		 * Grab all the pending mbufs at once, without locking.
+		 * rx_batch belongs to rxsync, what does not fit in the
+		 * ring stays there for the next round.
+		 */
+		if (mbq_len(q) < lim)
+			mbq_mp_splice(&kring->rx_queue, q);
+		mbq_init(&done);
 
 		nm_i = kring->nr_hwtail; /* first empty slot in the receive ring */
 		for (n = 0; nm_i != stop_i; n++) {
@@ -737,25 +1158,27 @@ generic_netmap_rxsync(struct netmap_kring *kring, int flags)
 			if (addr == NETMAP_BUF_BASE(na)) { /* Bad buffer */
 				return netmap_ring_reinit(kring);
 			}
-			/*
-			 * Call the locked version of the function.
-			 * XXX Ideally we could grab a batch of mbufs at once
-			 * and save some locking overhead.
-			 */
-			m = mbq_safe_dequeue(&kring->rx_queue);
+			m = mbq_dequeue(q);
 			if (!m)	/* no more data */
 				break;
+			if (mbq_peek(q))
+				__builtin_prefetch(MBUF_DATA(mbq_peek(q)));
 			len = MBUF_LEN(m);
 			m_copydata(m, 0, len, addr);
 			ring->slot[nm_i].len = len;
 			ring->slot[nm_i].flags = slot_flags;
-			m_freem(m);
+			mbq_enqueue(&done, m);
 			nm_i = nm_next(nm_i, lim);
 		}
+		generic_rx_recycle(&done);
 		if (n) {
 			kring->nr_hwtail = nm_i;
 			IFRATE(rate_ctx.new.rxpkt += n);
 		}
+		/* the burst is over, back to the base backlog */
+		if (mbq_len(q) + mbq_mp_len(&kring->rx_queue) <
+				generic_rx_backlog(kring) / 2)
+			kring->nkr_backlog = generic_rx_backlog(kring);
 		kring->nr_kflags &= ~NKR_PENDINTR;
 	}
 
@@ -844,7 +1267,7 @@ generic_netmap_attach(struct ifnet *ifp)
 	/* when using generic, NAF_NETMAP_ON is set so we force
 	 * NAF_SKIP_INTR to use the regular interrupt handler
 	 */
-	na->na_flags = NAF_SKIP_INTR | NAF_HOST_RINGS;
+	na->na_flags = NAF_SKIP_INTR | NAF_HOST_RINGS | NAF_GENERIC;
 
 	ND("[GNA] num_tx_queues(%d), real_num_tx_queues(%d), len(%lu)",
 			ifp->num_tx_queues, ifp->real_num_tx_queues,
@@ -853,6 +1276,12 @@ generic_netmap_attach(struct ifnet *ifp)
 			ifp->num_rx_queues, ifp->real_num_rx_queues);
 
 	generic_find_num_queues(ifp, &na->num_tx_rings, &na->num_rx_rings);
+	/* software rss can spread packets on more rings than the
+	 * hardware has (e.g. veth)
+	 */
+	if (netmap_generic_rss && na->num_rx_rings < netmap_generic_rings)
+		na->num_rx_rings = netmap_generic_rings;
+	generic_rss_init(gna);
 
 	retval = netmap_attach_common(na);
 	if (retval) {
@@ -77,6 +77,8 @@
 
 #define	NM_SELINFO_T	struct nm_selinfo
 #define	MBUF_LEN(m)	((m)->m_pkthdr.len)
+#define	MBUF_DATA(m)	((m)->m_data)
+#define	MBUF_HEADLEN(m)	((m)->m_len)
 #define	MBUF_IFP(m)	((m)->m_pkthdr.rcvif)
 #define	NM_SEND_UP(ifp, m)	((NA(ifp))->if_input)(ifp, m)
 
@@ -85,6 +87,22 @@
 #include <machine/atomic.h>
 #define NM_ATOMIC_TEST_AND_SET(p)       (!atomic_cmpset_acq_int((p), 0, 1))
 #define NM_ATOMIC_CLEAR(p)              atomic_store_rel_int((p), 0)
+#define NM_ATOMIC_ADD64(p, v)           atomic_add_64((volatile uint64_t *)(p), (v))
+
+/* cpu and cycle counter, used by the latency histograms */
+#include <sys/pcpu.h>		/* curcpu */
+#include <sys/smp.h>		/* mp_maxid */
+#include <machine/cpu.h>	/* get_cyclecount() */
+#define NM_CURCPU()	curcpu
+#define NM_NCPUS	(mp_maxid + 1)
+#define NM_CYCLES()	get_cyclecount()
+#define NM_FLS64(x)	flsll(x)
+
+/* bitmaps of u_long (used for the pending rings) */
+#define NM_BIT_SET(a, b)	atomic_set_long(&(a)[(b) / NM_LONG_BITS], \
+					1UL << ((b) % NM_LONG_BITS))
+#define NM_BIT_TEST_AND_CLEAR(a, b) \
+	atomic_testandclear_long(&(a)[(b) / NM_LONG_BITS], (b) % NM_LONG_BITS)
 
 #if __FreeBSD_version >= 1100030
 #define	WNA(_ifp)	(_ifp)->if_netmap
@@ -105,9 +123,15 @@ struct netmap_adapter *netmap_getna(if_t ifp);
 #define SET_MBUF_REFCNT(m, x)   *((m)->m_ext.ref_cnt) = x
 #define PNT_MBUF_REFCNT(m)      ((m)->m_ext.ref_cnt)
 #endif
+#define MBUF_SHARED(m)		0	/* the data is never shared */
 
 MALLOC_DECLARE(M_NETMAP);
 
+/* classic bpf for the monitor filters, <net/bpf.h> */
+#define nm_bpf_insn	bpf_insn
+#define nm_bpf_validate	bpf_validate
+#define nm_bpf_filter	bpf_filter
+
 struct nm_selinfo {
 	struct selinfo si;
 	struct mtx m;
@@ -130,6 +154,8 @@ struct hrtimer {
 #define	NM_LOCK_T	safe_spinlock_t	// see bsd_glue.h
 #define	NM_SELINFO_T	wait_queue_head_t
 #define	MBUF_LEN(m)	((m)->len)
+#define	MBUF_DATA(m)	((m)->data)
+#define	MBUF_HEADLEN(m)	skb_headlen(m)
 #define	MBUF_IFP(m)	((m)->dev)
 #define	NM_SEND_UP(ifp, m)  \
                         do { \
@@ -139,6 +165,14 @@ struct hrtimer {
 
 #define NM_ATOMIC_T	volatile long unsigned int
 
+#define NM_BIT_SET(a, b)		set_bit(b, a)
+#define NM_BIT_TEST_AND_CLEAR(a, b)	test_and_clear_bit(b, a)
+
+#define NM_CURCPU()	raw_smp_processor_id()
+#define NM_NCPUS	nr_cpu_ids
+#define NM_CYCLES()	((uint64_t)get_cycles())
+#define NM_FLS64(x)	fls64(x)
+
 #define NM_MTX_T	struct mutex	/* OS-specific sleepable lock */
 #define NM_MTX_INIT(m)	mutex_init(&(m))
 #define NM_MTX_DESTROY(m)	do { (void)(m); } while (0)
@@ -158,6 +192,8 @@ struct hrtimer {
 #define	NM_LOCK_T	IOLock *
 #define	NM_SELINFO_T	struct selinfo
 #define	MBUF_LEN(m)	((m)->m_pkthdr.len)
+#define	MBUF_DATA(m)	((m)->m_data)
+#define	MBUF_HEADLEN(m)	((m)->m_len)
 #define	NM_SEND_UP(ifp, m)	((ifp)->if_input)(ifp, m)
 
 #else
@@ -319,6 +355,11 @@ struct netmap_kring {
 	 */
 	volatile int nkr_stopped;
 
+	/* cycle counter at the first nm_notify() not yet seen by poll(),
+	 * only used by the latency histograms.
+	 */
+	uint64_t	nkr_notify_cycles;
+
 	/* Support for adapters without native netmap support.
 	 * On tx rings we preallocate an array of tx buffers
 	 * (same size as the netmap ring), on rx rings we
@@ -326,8 +367,30 @@ struct netmap_kring {
 	 * a rxsync.
 	 */
 	struct mbuf **tx_pool;
+	/* generic tx completions, as free running slot counts:
+	 * nkr_tx_done is written by the destructor of the event mbuf,
+	 * see generic_set_tx_event() and generic_netmap_tx_clean().
+	 */
+	u_int nkr_tx_reclaimed;		/* slots returned to the user */
+	u_int nkr_tx_event;		/* count after the event slot */
+	volatile u_int nkr_tx_done;	/* slots known to be completed */
+	volatile u_int nkr_tx_pending;	/* an event is outstanding */
+	struct mbuf *nkr_tx_event_mbuf;	/* the mbuf carrying the event */
+	u_int nkr_tx_zcopy;		/* zero-copy frames may be in flight */
 	// u_int nr_ntc;		/* Emulation of a next-to-clean RX ring pointer. */
 	struct mbq rx_queue;            /* intercepted rx mbufs. */
+	struct mbq rx_batch;		/* rx_queue mbufs owned by rxsync */
+	u_int nkr_backlog;		/* generic: current rx_queue limit */
+	/* tee pipe slaves: the buffers of the ring, then the index
+	 * of the master tx slot published in each rx slot (or
+	 * NM_PIPE_TEE_REVOKED), then the buffer published there
+	 */
+	uint32_t *nkr_tee_buf;
+
+	/* pipes: the rxsync of this ring wakes up the tx peer only
+	 * when nr_hwcur moves past this slot
+	 */
+	u_int nkr_pipe_event;
 
 	uint32_t	ring_id;	/* debugging */
 	char name[64];			/* diagnostic */
@@ -355,9 +418,14 @@ struct netmap_kring {
 #endif /* WITH_PIPES */
 
 #ifdef WITH_MONITOR
-	/* pointer to the adapter that is monitoring this kring (if any)
+	/* the adapters that are monitoring this kring (if any): the
+	 * copy monitors in monitors[], the zero-copy one in zmon
 	 */
-	struct netmap_monitor_adapter *monitor;
+	struct netmap_monitor_adapter **monitors;
+	u_int n_monitors;
+	u_int max_monitors;
+	struct netmap_monitor_adapter *zmon;
+	u_int mon_next;		/* first slot not seen by copy monitors */
 	/*
 	 * Monitors work by intercepting the txsync and/or rxsync of the
 	 * monitored krings. This is implemented by replacing
@@ -480,6 +548,11 @@ struct netmap_adapter {
 				 */
 #define NAF_HOST_RINGS  64	/* the adapter supports the host rings */
 #define NAF_FORCE_NATIVE 128	/* the adapter is always NATIVE */
+#define NAF_RESIZABLE	256	/* the krings can be resized while in use
+				 * (NM_CFG_RING_RESIZE), up to num_*_desc
+				 */
+#define NAF_GENERIC	512	/* netmap_generic_adapter (emulated) */
+#define NAF_BDG_TAP	1024	/* the tap of a VALE switch */
 #define	NAF_BUSY	(1U<<31) /* the adapter is used internally and
 				  * cannot be registered from userspace
 				  */
@@ -509,6 +582,19 @@ struct netmap_adapter {
 	/* count users of the global wait queues */
 	int tx_si_users, rx_si_users;
 
+	/* one bit per kring, set by nm_notify() before waking up
+	 * the global wait queues and consumed by netmap_poll(), so
+	 * that threads bound to all rings only sync the rings that
+	 * have news. Notify callbacks that wake up tx_si/rx_si
+	 * should use nm_notify_pending(). Allocated with the krings.
+	 */
+	u_long *tx_pending, *rx_pending;
+
+	/* per-cpu latency histograms, see nm_lat_record().
+	 * Allocated with the krings if dev.netmap.latency is set.
+	 */
+	struct netmap_lat *na_lat;
+
 	void *pdev; /* used to store pci device */
 
 	/* copy of if_qflush and if_transmit pointers, to intercept
@@ -621,10 +707,13 @@ struct netmap_adapter {
 	void *na_private;
 
 #ifdef WITH_PIPES
-	/* array of pipes that have this adapter as a parent */
-	struct netmap_pipe_adapter **na_pipes;
-	int na_next_pipe;	/* next free slot in the array */
-	int na_max_pipes;	/* size of the array */
+	/* hash table, by id, of the pipes that have this adapter
+	 * as a parent. Open addressing, grown to stay half empty.
+	 */
+	struct nm_pipe_entry *na_pipes;
+	int na_next_pipe;	/* used entries */
+	int na_max_pipes;	/* size of the table, a power of 2 */
+	int na_pipe_space;	/* pipe ids the memory can hold, 0: any */
 #endif /* WITH_PIPES */
 
 	char name[64];
@@ -657,6 +746,7 @@ struct netmap_vp_adapter {	/* VALE software port */
 	int bdg_port;
 	struct nm_bridge *na_bdg;
 	int retry;
+	struct nm_bridge *tap_bdg;	/* the switch, if this is its tap */
 
 	/* Offset of ethernet header for each packet. */
 	u_int virt_hdr_len;
@@ -682,6 +772,14 @@ struct nm_generic_mit {
 	int mit_pending;
 	int mit_ring_idx;  /* index of the ring being mitigated */
 	struct netmap_adapter *mit_na;  /* backpointer */
+	u_int mit_interval;	/* current timer period, ns */
+	u_int mit_count;	/* packets since the last notification */
+};
+
+/* software rss state of an emulated adapter, see NM_CFG_RSS */
+struct nm_generic_rss {
+	uint8_t key[NM_RSS_KEY_LEN];
+	uint8_t table[NM_RSS_TABLE_SIZE];
 };
 
 struct netmap_generic_adapter {	/* emulated device */
@@ -699,6 +797,7 @@ struct netmap_generic_adapter {	/* emulated device */
 	void (*save_if_input)(struct ifnet *, struct mbuf *);
 
 	struct nm_generic_mit *mit;
+	struct nm_generic_rss rss;
 #ifdef linux
         netdev_tx_t (*save_start_xmit)(struct mbuf *, struct ifnet *);
 #endif
@@ -790,7 +889,13 @@ int netmap_bwrap_attach(const char *name, struct netmap_adapter *);
 
 #ifdef WITH_PIPES
 
-#define NM_MAXPIPES 	64	/* max number of pipes per adapter */
+#define NM_MAXPIPES 	64	/* max hint for the pipes of an adapter */
+
+/* entry of the pipe table of the parent, one per id */
+struct nm_pipe_entry {
+	u_int id;
+	struct netmap_pipe_adapter *pna;	/* NULL if free */
+};
 
 struct netmap_pipe_adapter {
 	struct netmap_adapter up;
@@ -802,12 +907,41 @@ struct netmap_pipe_adapter {
 	struct netmap_pipe_adapter *peer; /* the other end of the pipe */
 	int peer_ref;		/* 1 iff we are holding a ref to the peer */
 
-	u_int parent_slot; /* index in the parent pipe array */
+	/* a group has ids [id, id + group), the master tx ring is
+	 * spread over the group rx rings of the slave
+	 */
+	u_int group;	/* 1 for a plain pipe */
+	int lb_rr;	/* round robin instead of flow hash */
+	u_int lb_next;	/* next ring for round robin */
+	int tee;	/* the group gets copies of all the slots */
+	int tee_block;	/* tee: wait for full rings instead of dropping */
 };
 
 #endif /* WITH_PIPES */
 
 
+#define NM_LONG_BITS	(sizeof(u_long) * 8)
+#define NM_BITMAP_LONGS(n)	(((n) + NM_LONG_BITS - 1) / NM_LONG_BITS)
+
+/* record that ring n_ring has news for the sleepers on the global queue */
+static inline void
+nm_notify_pending(struct netmap_adapter *na, u_int n_ring, enum txrx t)
+{
+	u_long *map = (t == NR_TX) ? na->tx_pending : na->rx_pending;
+
+	if (map)
+		NM_BIT_SET(map, n_ring);
+}
+
+/* test and clear the pending bit, avoiding the atomic if not set */
+static inline int
+nm_pending_grab(u_long *map, u_int n_ring)
+{
+	return (map[n_ring / NM_LONG_BITS] & (1UL << (n_ring % NM_LONG_BITS))) &&
+		NM_BIT_TEST_AND_CLEAR(map, n_ring);
+}
+
+
 /* return slots reserved to rx clients; used in drivers */
 static inline uint32_t
 nm_kr_rxspace(struct netmap_kring *k)
@@ -821,6 +955,60 @@ nm_kr_rxspace(struct netmap_kring *k)
 }
 
 
+/*
+ * Update the per-ring statistics in the shared memory
+ * (struct netmap_ring_stats). Callers must own the kring,
+ * except for the drops and the notifies, which are also
+ * counted by other threads (host stack, other bridge ports,
+ * interrupts) and use atomic adds.
+ */
+static inline void
+nm_kr_stats_slots(struct netmap_kring *kring, u_int from, u_int to)
+{
+	struct netmap_ring *ring = kring->ring;
+	struct netmap_ring_stats *st = NETMAP_RING_STATS(ring);
+	u_int lim = kring->nkr_num_slots - 1;
+	uint64_t bytes = 0;
+	u_int n = 0;
+
+	for (; from != to; from = nm_next(from, lim), n++)
+		bytes += ring->slot[from].len;
+	st->packets += n;
+	st->bytes += bytes;
+}
+
+static inline void
+nm_kr_stats_drop(struct netmap_kring *kring, u_int reason, u_int n)
+{
+	if (netmap_stats && kring->ring)
+		NM_ATOMIC_ADD64(&NETMAP_RING_STATS(kring->ring)->drops[reason], n);
+}
+
+
+/*
+ * Latency histograms (struct nm_lat_req), one set per cpu so that
+ * updates do not bounce cache lines. Samples are only collected
+ * when dev.netmap.latency is set and the histograms were allocated.
+ */
+struct netmap_lat {
+	uint64_t	h[NM_LAT_NUM][NM_LAT_BUCKETS];
+} __attribute__((__aligned__(64)));
+
+#define NM_LAT_ON(_na)	unlikely(netmap_latency && (_na)->na_lat != NULL)
+
+static inline void
+nm_lat_record(struct netmap_adapter *na, u_int hist, uint64_t v)
+{
+	u_int b = NM_FLS64(v);
+
+	if (b > 0)
+		b--;
+	if (b >= NM_LAT_BUCKETS)
+		b = NM_LAT_BUCKETS - 1;
+	na->na_lat[NM_CURCPU()].h[hist][b]++;
+}
+
+
 /* True if no space in the tx ring. only valid after txsync_prologue */
 static inline int
 nm_kr_txempty(struct netmap_kring *kring)
@@ -986,6 +1174,8 @@ nm_txsync_finalize(struct netmap_kring *kring)
 {
 	/* update ring tail to what the kernel knows */
 	kring->ring->tail = kring->rtail = kring->nr_hwtail;
+	if (netmap_stats)
+		NETMAP_RING_STATS(kring->ring)->syncs++;
 
 	/* note, head/rhead/hwcur might be behind cur/rcur
 	 * if no carrier
@@ -1006,6 +1196,11 @@ nm_rxsync_finalize(struct netmap_kring *kring)
 	//struct netmap_ring *ring = kring->ring;
 	ND("head %d cur %d tail %d -> %d", ring->head, ring->cur, ring->tail,
 		kring->nr_hwtail);
+	if (netmap_stats) {
+		/* new slots are in rtail .. hwtail */
+		nm_kr_stats_slots(kring, kring->rtail, kring->nr_hwtail);
+		NETMAP_RING_STATS(kring->ring)->syncs++;
+	}
 	kring->ring->tail = kring->rtail = kring->nr_hwtail;
 	/* make a copy of the state for next round */
 	kring->rhead = kring->ring->head;
@@ -1132,36 +1327,45 @@ int netmap_init_bridges(void);
 void netmap_uninit_bridges(void);
 int netmap_bdg_ctl(struct nmreq *nmr, struct netmap_bdg_ops *bdg_ops);
 int netmap_bdg_config(struct nmreq *nmr);
+int netmap_bdg_tap_filter(struct netmap_priv_d *, struct nm_filter_req *);
 
 #else /* !WITH_VALE */
 #define	netmap_get_bdg_na(_1, _2, _3)	0
 #define netmap_init_bridges(_1) 0
 #define netmap_uninit_bridges()
 #define	netmap_bdg_ctl(_1, _2)	EINVAL
+#define netmap_bdg_tap_filter(_1, _2)	EOPNOTSUPP
 #endif /* !WITH_VALE */
 
 #ifdef WITH_PIPES
-/* max number of pipes per device */
-#define NM_MAXPIPES	64	/* XXX how many? */
-/* in case of no error, returns the actual number of pipes in nmr->nr_arg1 */
+/* in case of no error, returns the expected number of pipes in nmr->nr_arg1 */
 int netmap_pipe_alloc(struct netmap_adapter *, struct nmreq *nmr);
 void netmap_pipe_dealloc(struct netmap_adapter *);
 int netmap_get_pipe_na(struct nmreq *nmr, struct netmap_adapter **na, int create);
+int netmap_pipe_group_ring(struct netmap_adapter *na, u_int pipe_id);
 #else /* !WITH_PIPES */
 #define NM_MAXPIPES	0
 #define netmap_pipe_alloc(_1, _2) 	0
 #define netmap_pipe_dealloc(_1)
+#define netmap_pipe_group_ring(_1, _2)	(-1)
 #define netmap_get_pipe_na(nmr, _2, _3)	\
 	({ int role__ = (nmr)->nr_flags & NR_REG_MASK; \
 	   (role__ == NR_REG_PIPE_MASTER || 	       \
 	    role__ == NR_REG_PIPE_SLAVE) ? EOPNOTSUPP : 0; })
 #endif
 
+/* NM_CFG_FILTER programs, for monitors and switch taps */
+int nm_filter_copyin(struct nm_filter_req *, struct nm_bpf_insn **);
+
 #ifdef WITH_MONITOR
 int netmap_get_monitor_na(struct nmreq *nmr, struct netmap_adapter **na, int create);
+int netmap_monitor_filter(struct netmap_priv_d *, struct nm_filter_req *);
+int netmap_monitor_sample_config(struct netmap_priv_d *, struct nm_sample_req *);
 #else
 #define netmap_get_monitor_na(nmr, _2, _3) \
 	((nmr)->nr_flags & (NR_MONITOR_TX | NR_MONITOR_RX) ? EOPNOTSUPP : 0)
+#define netmap_monitor_filter(_1, _2)	EOPNOTSUPP
+#define netmap_monitor_sample_config(_1, _2)	EOPNOTSUPP
 #endif
 
 #ifdef CONFIG_NET_NS
@@ -1185,6 +1389,13 @@ int netmap_dtor_locked(struct netmap_priv_d *priv);
 
 int netmap_ioctl(struct cdev *dev, u_long cmd, caddr_t data, int fflag, struct thread *td);
 
+/* fd -> netmap_priv_d lookup for NIOCSYNCV, implemented in the OS code.
+ * The cookie keeps a reference to the file, release it with putpriv.
+ */
+int netmap_fd_getpriv(int fd, struct thread *td,
+	struct netmap_priv_d **priv, void **cookie);
+void netmap_fd_putpriv(void *cookie, struct thread *td);
+
 /* netmap_adapter creation/destruction */
 
 // #define NM_DEBUG_PUTGET 1
@@ -1228,6 +1439,8 @@ int netmap_adapter_put(struct netmap_adapter *na);
 extern int netmap_mitigate;	// XXX not really used
 extern int netmap_no_pendintr;
 extern int netmap_verbose;	// XXX debugging
+extern int netmap_stats;
+extern int netmap_latency;
 enum {                                  /* verbose flags */
 	NM_VERB_ON = 1,                 /* generic verbose */
 	NM_VERB_HOST = 0x2,             /* verbose host stack */
@@ -1243,6 +1456,13 @@ extern int netmap_txsync_retry;
 extern int netmap_generic_mit;
 extern int netmap_generic_ringsize;
 extern int netmap_generic_rings;
+extern int netmap_generic_txqdisc;
+extern int netmap_generic_rss;
+extern int netmap_generic_mit_adaptive;
+extern int netmap_generic_mit_latency;
+extern int netmap_generic_mit_batch;
+extern int netmap_generic_rx_backlog;
+extern int netmap_generic_rx_burst;
 
 /*
  * NA returns a pointer to the struct netmap adapter from the ifp,
@@ -1531,6 +1751,24 @@ struct netmap_monitor_adapter {
 
 	struct netmap_priv_d priv;
 	uint32_t flags;
+	u_int snaplen;		/* copy monitors: bytes per frame */
+	struct nm_bpf_insn *filter;	/* NM_CFG_FILTER, if not NULL */
+
+	/* NM_CFG_SAMPLE */
+	u_int sample_policy;	/* NM_SAMPLE_* */
+	uint32_t sample_arg;
+	uint32_t sample_burst;
+	struct nm_sampler *samplers; /* one per monitored ring */
+};
+
+/* sampling state of a monitored ring. Only used within the
+ * nm_sync of the ring, so it needs no lock.
+ */
+struct nm_sampler {
+	uint32_t left;		/* NTH: frames to the next sample,
+				 * PPS: tokens */
+	uint32_t rnd;		/* PROB: xorshift state */
+	uint64_t last;		/* PPS: time of the last refill, ns */
 };
 
 #endif /* WITH_MONITOR */
@@ -1545,8 +1783,28 @@ int generic_netmap_attach(struct ifnet *ifp);
 
 int netmap_catch_rx(struct netmap_adapter *na, int intercept);
 void generic_rx_handler(struct ifnet *ifp, struct mbuf *m);;
+int generic_rss_config(struct netmap_adapter *na, struct nm_rss_req *req);
+uint32_t nm_rss_hash(const uint8_t *key, const uint8_t *buf, u_int len);
 void netmap_catch_tx(struct netmap_generic_adapter *na, int enable);
-int generic_xmit_frame(struct ifnet *ifp, struct mbuf *m, void *addr, u_int len, u_int ring_nr);
+/* flags for generic_xmit_frame() */
+#define GENERIC_XMIT_DIRECT	0x1	/* bypass the qdisc, queue is locked */
+#define GENERIC_XMIT_MORE	0x2	/* more frames follow in this batch */
+/* returned by generic_xmit_frame() for a frame that does not fit */
+#define GENERIC_XMIT_DROP	(-2)
+int generic_xmit_frame(struct ifnet *ifp, struct mbuf *m,
+	struct netmap_kring *kring, u_int first, u_int nfrags, int flags);
+#ifdef linux
+int generic_xmit_ready(struct ifnet *ifp, struct netmap_kring *kring,
+	u_int first, u_int nfrags, int flags);
+void generic_xmit_lock(struct ifnet *ifp, u_int ring_nr);
+void generic_xmit_unlock(struct ifnet *ifp, u_int ring_nr);
+void generic_rx_recycle(struct mbq *q);
+#else
+#define generic_xmit_ready(ifp, kring, first, nfrags, flags)	1
+#define generic_xmit_lock(ifp, ring_nr)
+#define generic_xmit_unlock(ifp, ring_nr)
+#define generic_rx_recycle(q)	mbq_purge(q)
+#endif
 int generic_find_num_desc(struct ifnet *ifp, u_int *tx, u_int *rx);
 void generic_find_num_queues(struct ifnet *ifp, u_int *txq, u_int *rxq);
 
@@ -1564,6 +1822,7 @@ void generic_rate(int txp, int txs, int txi, int rxp, int rxs, int rxi);
  */
 void netmap_mitigation_init(struct nm_generic_mit *mit, int idx,
                                 struct netmap_adapter *na);
+void generic_mit_adapt(struct nm_generic_mit *mit);
 void netmap_mitigation_start(struct nm_generic_mit *mit);
 void netmap_mitigation_restart(struct nm_generic_mit *mit);
 int netmap_mitigation_active(struct nm_generic_mit *mit);
@@ -1583,7 +1842,7 @@ void netmap_mitigation_cleanup(struct nm_generic_mit *mit);
 struct nm_bdg_fwd {	/* forwarding entry for a bridge */
 	void *ft_buf;		/* netmap or indirect buffer */
 	uint8_t ft_frags;	/* how many fragments (only on 1st frag) */
-	uint8_t _ft_port;	/* dst port (unused) */
+	uint8_t ft_port;	/* dst port, for the switch tap */
 	uint16_t ft_flags;	/* flags, e.g. indirect */
 	uint16_t ft_len;	/* src fragment len */
 	uint16_t ft_next;	/* next packet to same destination */
@@ -28,7 +28,9 @@
  */
 
 
-#ifdef linux
+#if defined(NM_MBQ_USERSPACE)
+/* built in userspace by examples/testmbq.c, which provides the glue */
+#elif defined(linux)
 #include "bsd_glue.h"
 #else   /* __FreeBSD__ */
 #include <sys/param.h>
@@ -36,6 +38,7 @@
 #include <sys/mutex.h>
 #include <sys/systm.h>
 #include <sys/mbuf.h>
+#include <machine/atomic.h>
 #endif  /* __FreeBSD__ */
 
 #include "netmap_mbq.h"
@@ -51,13 +54,15 @@ static inline void __mbq_init(struct mbq *q)
 void mbq_safe_init(struct mbq *q)
 {
     mtx_init(&q->lock, "mbq", NULL, MTX_SPIN);
-    __mbq_init(q);
+    mbq_init(q);
 }
 
 
 void mbq_init(struct mbq *q)
 {
     __mbq_init(q);
+    q->mp_top = NULL;
+    q->mp_count = 0;
 }
 
 
@@ -124,11 +129,68 @@ struct mbuf *mbq_dequeue(struct mbq *q)
 }
 
 
+/*
+ * Push m on the inbox of q. Lock-free, can be called by any number
+ * of producers at the same time.
+ */
+void mbq_mp_enqueue(struct mbq *q, struct mbuf *m)
+{
+    struct mbuf *top;
+
+    do {
+        top = q->mp_top;
+        m->m_nextpkt = top;
+    } while (!MBQ_CAS_REL_PTR(&q->mp_top, top, m));
+    MBQ_ADD_INT(&q->mp_count, 1);
+}
+
+
+/*
+ * Move the whole inbox of q to the tail of dst, in arrival order.
+ * Only one consumer at a time; dst may be q itself if the caller
+ * owns the FIFO part of q (e.g. holds its lock).
+ */
+void mbq_mp_splice(struct mbq *q, struct mbq *dst)
+{
+    struct mbuf *top, *head = NULL, *tail, *m;
+    int n = 0;
+
+    if (q->mp_top == NULL)
+        return;
+    top = MBQ_SWAP_ACQ_PTR(&q->mp_top, NULL);
+    if (top == NULL)
+        return;
+
+    /* reverse the list, the inbox is LIFO */
+    tail = top;
+    while (top) {
+        m = top;
+        top = m->m_nextpkt;
+        m->m_nextpkt = head;
+        head = m;
+        n++;
+    }
+    MBQ_ADD_INT(&q->mp_count, -n);
+    if (dst->tail) {
+        dst->tail->m_nextpkt = head;
+    } else {
+        dst->head = head;
+    }
+    dst->tail = tail;
+    dst->count += n;
+}
+
+
 /* XXX seems pointless to have a generic purge */
 static void __mbq_purge(struct mbq *q, int safe)
 {
     struct mbuf *m;
 
+    if (safe)
+        mbq_lock(q);
+    mbq_mp_splice(q, q);
+    if (safe)
+        mbq_unlock(q);
     for (;;) {
         m = safe ? mbq_safe_dequeue(q) : mbq_dequeue(q);
         if (m) {
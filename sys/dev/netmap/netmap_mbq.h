@@ -35,13 +35,39 @@
  * These function implement an mbuf tailq with an optional lock.
  * The base functions act ONLY ON THE QUEUE, whereas the "safe"
  * variants (mbq_safe_*) also handle the lock.
+ *
+ * The mbq_mp_* functions use a lock-free inbox instead, for the
+ * case of several producers and a single consumer: any number of
+ * mbq_mp_enqueue() can run concurrently with each other and with
+ * mbq_mp_splice(), which must not run concurrently with itself.
  */
 
 /* XXX probably rely on a previous definition of SPINLOCK_T */
+/*
+ * The producers publish an mbuf with a release CAS, the consumer
+ * takes the whole inbox with an acquire swap, so that it sees the
+ * m_nextpkt links and the contents written before the push.
+ */
 #ifdef linux
 #define SPINLOCK_T  safe_spinlock_t
+#define MBQ_CAS_REL_PTR(p, o, n) (cmpxchg((p), (o), (n)) == (o))
+#define MBQ_SWAP_ACQ_PTR(p, n)	xchg((p), (n))
+#define MBQ_ADD_INT(p, v)	atomic_add((v), (atomic_t *)(p))
 #else
 #define SPINLOCK_T  struct mtx
+#define MBQ_CAS_REL_PTR(p, o, n) atomic_cmpset_rel_ptr((volatile uintptr_t *)(p), \
+					(uintptr_t)(o), (uintptr_t)(n))
+static inline void *
+mbq_swap_acq_ptr(volatile uintptr_t *p, uintptr_t n)
+{
+	uintptr_t o = atomic_swap_ptr(p, n);
+
+	atomic_thread_fence_acq();
+	return (void *)o;
+}
+#define MBQ_SWAP_ACQ_PTR(p, n)	mbq_swap_acq_ptr((volatile uintptr_t *)(p), \
+					(uintptr_t)(n))
+#define MBQ_ADD_INT(p, v)	atomic_add_int((volatile u_int *)(p), (v))
 #endif
 
 /* A FIFO queue of mbufs with an optional lock. */
@@ -50,6 +76,8 @@ struct mbq {
     struct mbuf *tail;
     int count;
     SPINLOCK_T lock;
+    struct mbuf * volatile mp_top;	/* inbox, most recent first */
+    volatile int mp_count;		/* mbufs in the inbox, estimate */
 };
 
 /* XXX "destroy" does not match "init" as a name.
@@ -81,9 +109,25 @@ void mbq_safe_enqueue(struct mbq *q, struct mbuf *m);
 struct mbuf *mbq_safe_dequeue(struct mbq *q);
 void mbq_safe_purge(struct mbq *q);
 
+void mbq_mp_enqueue(struct mbq *q, struct mbuf *m);
+void mbq_mp_splice(struct mbq *q, struct mbq *dst);
+
 static inline unsigned int mbq_len(struct mbq *q)
 {
     return q->count;
 }
 
+/* Length including the inbox, may be off while producers run. */
+static inline unsigned int mbq_mp_len(struct mbq *q)
+{
+    int n = q->count + q->mp_count;
+
+    return n > 0 ? n : 0;
+}
+
+static inline struct mbuf *mbq_peek(struct mbq *q)
+{
+    return q->head;
+}
+
 #endif /* __NETMAP_MBQ_H_ */
@@ -249,14 +249,14 @@ const struct netmap_mem_d nm_blueprint = {
 			.objminsize = sizeof(struct netmap_if),
 			.objmaxsize = 4096,
 			.nummin     = 1,
-			.nummax	    = 100,
+			.nummax	    = 10000,	/* 4 per pipe */
 		},
 		[NETMAP_RING_POOL] = {
 			.name 	= "%s_ring",
 			.objminsize = sizeof(struct netmap_ring),
 			.objmaxsize = 32*PAGE_SIZE,
 			.nummin     = 2,
-			.nummax	    = 1024,
+			.nummax	    = 16384,	/* 8 per pipe */
 		},
 		[NETMAP_BUF_POOL] = {
 			.name	= "%s_buf",
@@ -1140,7 +1140,7 @@ netmap_mem_private_new(const char *name, u_int txr, u_int txd,
 	if (p[NETMAP_IF_POOL].num < v)
 		p[NETMAP_IF_POOL].num = v;
 	maxd = (txd > rxd) ? txd : rxd;
-	v = sizeof(struct netmap_ring) + sizeof(struct netmap_slot) * maxd;
+	v = NETMAP_RING_STATS_OFS(maxd) + sizeof(struct netmap_ring_stats);
 	if (p[NETMAP_RING_POOL].size < v)
 		p[NETMAP_RING_POOL].size = v;
 	/* each pipe endpoint needs two tx rings (1 normal + 1 host, fake)
@@ -1329,8 +1329,9 @@ netmap_mem_rings_create(struct netmap_adapter *na)
 			continue; /* already created by somebody else */
 		}
 		ndesc = kring->nkr_num_slots;
-		len = sizeof(struct netmap_ring) +
-			  ndesc * sizeof(struct netmap_slot);
+		/* the slots are followed by the ring statistics */
+		len = NETMAP_RING_STATS_OFS(ndesc) +
+			  sizeof(struct netmap_ring_stats);
 		ring = netmap_ring_malloc(na->nm_mem, len);
 		if (ring == NULL) {
 			D("Cannot allocate tx_ring");
@@ -1339,6 +1340,7 @@ netmap_mem_rings_create(struct netmap_adapter *na)
 		ND("txring at %p", ring);
 		kring->ring = ring;
 		*(uint32_t *)(uintptr_t)&ring->num_slots = ndesc;
+		bzero(NETMAP_RING_STATS(ring), sizeof(struct netmap_ring_stats));
 		*(int64_t *)(uintptr_t)&ring->buf_ofs =
 		    (na->nm_mem->pools[NETMAP_IF_POOL].memtotal +
 			na->nm_mem->pools[NETMAP_RING_POOL].memtotal) -
@@ -1372,8 +1374,9 @@ netmap_mem_rings_create(struct netmap_adapter *na)
 			continue; /* already created by somebody else */
 		}
 		ndesc = kring->nkr_num_slots;
-		len = sizeof(struct netmap_ring) +
-			  ndesc * sizeof(struct netmap_slot);
+		/* the slots are followed by the ring statistics */
+		len = NETMAP_RING_STATS_OFS(ndesc) +
+			  sizeof(struct netmap_ring_stats);
 		ring = netmap_ring_malloc(na->nm_mem, len);
 		if (ring == NULL) {
 			D("Cannot allocate rx_ring");
@@ -1382,6 +1385,7 @@ netmap_mem_rings_create(struct netmap_adapter *na)
 		ND("rxring at %p", ring);
 		kring->ring = ring;
 		*(uint32_t *)(uintptr_t)&ring->num_slots = ndesc;
+		bzero(NETMAP_RING_STATS(ring), sizeof(struct netmap_ring_stats));
 		*(int64_t *)(uintptr_t)&ring->buf_ofs =
 		    (na->nm_mem->pools[NETMAP_IF_POOL].memtotal +
 		        na->nm_mem->pools[NETMAP_RING_POOL].memtotal) -
@@ -1420,6 +1424,47 @@ cleanup:
 	return ENOMEM;
 }
 
+/*
+ * Change the number of slots of a stopped kring, allocating or freeing
+ * the buffers at the end of the ring. The ring object was sized for
+ * the slots of a new kring, so nslots must not exceed that number.
+ * The statistics that follow the slots are moved accordingly.
+ */
+int
+netmap_mem_ring_resize(struct netmap_adapter *na, struct netmap_kring *kring,
+	u_int nslots)
+{
+	struct netmap_ring *ring = kring->ring;
+	struct netmap_ring_stats st;
+	u_int old = kring->nkr_num_slots;
+	int error = 0;
+
+	if (ring == NULL)
+		return ENXIO;
+	if (nslots == old)
+		return 0;
+
+	NMA_LOCK(na->nm_mem);
+	/* the new slots may overlap the statistics */
+	st = *NETMAP_RING_STATS(ring);
+	if (nslots > old) {
+		error = netmap_new_bufs(na->nm_mem, ring->slot + old,
+			nslots - old);
+	} else {
+		netmap_free_bufs(na->nm_mem, ring->slot + nslots,
+			old - nslots);
+	}
+	if (error == 0) {
+		*(uint32_t *)(uintptr_t)&ring->num_slots = nslots;
+		kring->nkr_num_slots = nslots;
+	}
+	*NETMAP_RING_STATS(ring) = st;
+	NMA_UNLOCK(na->nm_mem);
+
+	return error;
+}
+
+
 void
 netmap_mem_rings_delete(struct netmap_adapter *na)
 {
@@ -140,6 +140,8 @@ void	   netmap_mem_private_delete(struct netmap_mem_d *);
 #define NETMAP_MEM_IO		0x4	/* the underlying memory is mmapped I/O */
 
 uint32_t netmap_extra_alloc(struct netmap_adapter *, uint32_t *, uint32_t n);
+int	   netmap_mem_ring_resize(struct netmap_adapter *, struct netmap_kring *,
+	u_int nslots);
 
 
 #endif
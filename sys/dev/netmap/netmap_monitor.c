@@ -49,11 +49,32 @@
  *    has released them. In most cases, the consumer is a userspace
  *    application which may have modified the frame contents.
  *
+ * With NR_MONITOR_SPLIT, the tx traffic goes instead to the tx rings of the
+ * monitor, so that the two directions do not share a ring (and a lock). The
+ * monitor reads them like rx rings: the frames are between head and tail, and
+ * a txsync releases the slots before head. In all cases the slots of the
+ * monitor are tagged with NS_MONITOR_TX if they come from a tx ring, and hold
+ * in 'ptr' the time they were seen, in nanoseconds.
+ *
+ * A monitor can also take only a sample of the frames (NM_CFG_SAMPLE). The
+ * sampling state is kept for each monitored ring, and is only touched by the
+ * nm_sync of that ring. Batches without sampled frames return before locking
+ * the monitor ring.
+ *
  * If the monitor is not able to cope with the stream of frames, excess traffic
- * will be dropped.
+ * will be dropped, and counted in the statistics of the monitor ring.
+ *
+ * With NR_MONITOR_COPY the monitor has its own memory region, and gets a copy
+ * of (up to snaplen bytes of) each frame instead of the buffer itself. The
+ * monitored slots are not touched, and the frames are seen earlier:
+ *
+ *  - tx frames when the txsync passes them to the NIC;
  *
- * Each ring can be monitored by at most one monitor. This may change in the
- * future, if we implement monitor chaining.
+ *  - rx frames when the rxsync receives them, before the consumer
+ *    sees them.
+ *
+ * Each ring can be monitored by any number of copy monitors, and by at most
+ * one zero-copy monitor, since a buffer can only be given to one of them.
  *
  */
 
@@ -76,6 +97,7 @@
 #include <net/if_var.h>
 #include <machine/bus.h>	/* bus_dmamap_* */
 #include <sys/refcount.h>
+#include <net/bpf.h>	/* bpf_filter() */
 
 
 #elif defined(linux)
@@ -105,35 +127,155 @@
 
 #define NM_MONITOR_MAXSLOTS 4096
 
-/* monitor works by replacing the nm_sync callbacks in the monitored rings.
- * The actions to be performed are the same on both tx and rx rings, so we
- * have collected them here
+/*
+ * A monitored kring keeps the list of the copy monitors attached to it
+ * (monitors[]) and at most one zero-copy monitor (zmon). The nm_sync of
+ * the kring is replaced only once, when the first monitor arrives, by
+ * netmap_monitor_parent_txsync() or netmap_monitor_parent_rxsync().
+ * These call the original sync, saved in save_sync, and then feed all
+ * the monitors with direct calls.
+ */
+
+/* the monitor ring of mna that gets the frames of kring */
+static inline struct netmap_kring *
+netmap_monitor_kring(struct netmap_monitor_adapter *mna,
+	struct netmap_kring *kring, int tx)
+{
+	return (tx && (mna->flags & NR_MONITOR_SPLIT)) ?
+		&mna->up.tx_rings[kring->ring_id] :
+		&mna->up.rx_rings[kring->ring_id];
+}
+
+/* the time stamp of the monitor slots, in ns since the epoch */
+static inline uint64_t
+netmap_monitor_tstamp(void)
+{
+#ifdef linux
+	return ktime_get_real_ns();
+#else
+	struct timespec ts;
+
+	nanotime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* the sampling state of mna for the monitored kring, if any */
+static inline struct nm_sampler *
+netmap_monitor_sampler(struct netmap_monitor_adapter *mna,
+	struct netmap_kring *kring, int tx)
+{
+	if (mna->samplers == NULL)
+		return NULL;
+	return &mna->samplers[tx ? kring->ring_id :
+		kring->na->num_tx_rings + 1 + kring->ring_id];
+}
+
+/* called once per batch of n frames: return nonzero if none of them
+ * can be sampled. PPS sampling refills its tokens here, reading the
+ * clock in *now.
  */
 static int
-netmap_monitor_parent_sync(struct netmap_kring *kring, int flags, u_int* ringptr)
+netmap_monitor_skip(struct netmap_monitor_adapter *mna,
+	struct nm_sampler *sm, u_int n, uint64_t *now)
 {
-	struct netmap_monitor_adapter *mna = kring->monitor;
-	struct netmap_kring *mkring = &mna->up.rx_rings[kring->ring_id];
-	struct netmap_ring *ring = kring->ring, *mring = mkring->ring;
-	int error;
-	int rel_slots, free_slots, busy;
-	u_int beg, end, i;
-	u_int lim = kring->nkr_num_slots - 1,
-	      mlim = mkring->nkr_num_slots - 1;
+	uint64_t d, t;
 
-	/* get the relased slots (rel_slots) */
-	beg = *ringptr;
-	error = kring->save_sync(kring, flags);
-	if (error)
-		return error;
-	end = *ringptr;
-	rel_slots = end - beg;
-	if (rel_slots < 0)
-		rel_slots += kring->nkr_num_slots;
+	switch (mna->sample_policy) {
+	case NM_SAMPLE_NTH:
+		if (sm->left <= n)
+			return 0;
+		sm->left -= n;
+		return 1;
+
+	case NM_SAMPLE_PPS:
+		*now = netmap_monitor_tstamp();
+		d = *now - sm->last;
+		if (d >= 1000000000ULL) {
+			sm->left = mna->sample_burst;
+			sm->last = *now;
+		} else if ((t = d * mna->sample_arg / 1000000000ULL)) {
+			sm->last += t * 1000000000ULL / mna->sample_arg;
+			t += sm->left;
+			sm->left = t < mna->sample_burst ?
+				t : mna->sample_burst;
+		}
+		return sm->left == 0;
+	}
+	return 0;
+}
 
-	if (!rel_slots) {
-		return 0;
+/* return nonzero if the next frame must go to the monitor */
+static inline int
+netmap_monitor_sample(struct netmap_monitor_adapter *mna,
+	struct nm_sampler *sm)
+{
+	switch (mna->sample_policy) {
+	case NM_SAMPLE_NTH:
+		if (--sm->left)
+			return 0;
+		sm->left = mna->sample_arg;
+		return 1;
+
+	case NM_SAMPLE_PROB: /* xorshift32 */
+		sm->rnd ^= sm->rnd << 13;
+		sm->rnd ^= sm->rnd >> 17;
+		sm->rnd ^= sm->rnd << 5;
+		return sm->rnd < mna->sample_arg;
+
+	case NM_SAMPLE_PPS:
+		if (sm->left == 0)
+			return 0;
+		sm->left--;
+		return 1;
 	}
+	return 1;
+}
+
+/* the filter of mna on slot s of the monitored kring: return how many
+ * bytes of the frame the monitor wants, 0 if none
+ */
+static inline u_int
+netmap_monitor_match(struct netmap_kring *kring,
+	struct netmap_monitor_adapter *mna, struct netmap_slot *s)
+{
+	u_int len = s->len, snap;
+
+	if (len > NETMAP_BUF_SIZE(kring->na))
+		len = NETMAP_BUF_SIZE(kring->na);
+	/* bpf_filter(9) takes a zero buflen as an mbuf chain */
+	if (mna->filter == NULL || len == 0)
+		return len;
+	snap = nm_bpf_filter(mna->filter, NMB(kring->na, s), s->len, len);
+	return (snap < len) ? snap : len;
+}
+
+/* zero-copy monitors: swap the buffers of the slots from beg to end of
+ * the monitored kring with the free ones of the monitor ring. Frames
+ * rejected by the filter are skipped, the ones that do not fit are
+ * dropped.
+ */
+static void
+netmap_monitor_zcopy(struct netmap_kring *kring,
+	struct netmap_monitor_adapter *mna, u_int beg, u_int end, int tx)
+{
+	struct netmap_kring *mkring = netmap_monitor_kring(mna, kring, tx);
+	struct netmap_ring *ring = kring->ring, *mring = mkring->ring;
+	int free_slots, busy;
+	u_int i, drops = 0;
+	u_int lim = kring->nkr_num_slots - 1,
+	      mlim = mkring->nkr_num_slots - 1;
+	uint16_t dir = tx ? NS_MONITOR_TX : 0;
+	struct nm_sampler *sm = netmap_monitor_sampler(mna, kring, tx);
+	uint64_t ts = 0;
+
+	if (beg == end)
+		return;
+	if (sm && netmap_monitor_skip(mna, sm, (end < beg ?
+			end + kring->nkr_num_slots : end) - beg, &ts))
+		return;
+	if (ts == 0)
+		ts = netmap_monitor_tstamp();
 
 	/* we need to lock the monitor receive ring, since it
 	 * is the target of bot tx and rx traffic from the monitored
@@ -147,24 +289,21 @@ netmap_monitor_parent_sync(struct netmap_kring *kring, int flags, u_int* ringptr
 		busy += mkring->nkr_num_slots;
 	free_slots = mlim - busy;
 
-	if (!free_slots) {
-		mtx_unlock(&mkring->q_lock);
-		return 0;
-	}
-
-	/* swap min(free_slots, rel_slots) slots */
-	if (free_slots < rel_slots) {
-		beg += (rel_slots - free_slots);
-		if (beg > lim)
-			beg = 0;
-		rel_slots = free_slots;
-	}
-
-	for ( ; rel_slots; rel_slots--) {
+	for ( ; beg != end; beg = nm_next(beg, lim)) {
 		struct netmap_slot *s = &ring->slot[beg];
-		struct netmap_slot *ms = &mring->slot[i];
+		struct netmap_slot *ms;
 		uint32_t tmp;
 
+		if (sm && !netmap_monitor_sample(mna, sm))
+			continue;
+		if (mna->filter && !netmap_monitor_match(kring, mna, s))
+			continue;
+		if (!free_slots) {
+			drops++;
+			continue;
+		}
+		ms = &mring->slot[i];
+
 		tmp = ms->buf_idx;
 		ms->buf_idx = s->buf_idx;
 		s->buf_idx = tmp;
@@ -174,49 +313,324 @@ netmap_monitor_parent_sync(struct netmap_kring *kring, int flags, u_int* ringptr
 		s->len = tmp;
 
 		s->flags |= NS_BUF_CHANGED;
+		ms->flags = dir;
+		ms->ptr = ts;
 
-		beg = nm_next(beg, lim);
 		i = nm_next(i, mlim);
-
+		free_slots--;
+	}
+	if (drops)
+		nm_kr_stats_drop(mkring, NR_DROP_RING_FULL, drops);
+	if (i == mkring->nr_hwtail) {
+		mtx_unlock(&mkring->q_lock);
+		return;
 	}
 	mb();
 	mkring->nr_hwtail = i;
 
 	mtx_unlock(&mkring->q_lock);
 	/* notify the new frames to the monitor */
-	mna->up.nm_notify(&mna->up, mkring->ring_id, NR_RX, 0);
-	return 0;
+	mna->up.nm_notify(&mna->up, mkring->ring_id,
+		mkring == &mna->up.tx_rings[mkring->ring_id] ? NR_TX : NR_RX, 0);
+}
+
+/* copy monitors: copy the slots from beg to end of the monitored kring
+ * into the monitor ring, up to the snaplen and the length returned by
+ * the filter. Frames that do not fit are dropped.
+ */
+static void
+netmap_monitor_copy(struct netmap_kring *kring,
+	struct netmap_monitor_adapter *mna, u_int beg, u_int end, int tx)
+{
+	struct netmap_kring *mkring = netmap_monitor_kring(mna, kring, tx);
+	struct netmap_ring *ring = kring->ring, *mring = mkring->ring;
+	u_int lim = kring->nkr_num_slots - 1,
+	      mlim = mkring->nkr_num_slots - 1;
+	u_int max_len = NETMAP_BUF_SIZE(&mna->up);
+	u_int i, free_slots, drops = 0;
+	uint16_t dir = tx ? NS_MONITOR_TX : 0;
+	struct nm_sampler *sm = netmap_monitor_sampler(mna, kring, tx);
+	uint64_t ts = 0;
+	int busy;
+
+	if (beg == end)
+		return;
+	if (sm && netmap_monitor_skip(mna, sm, (end < beg ?
+			end + kring->nkr_num_slots : end) - beg, &ts))
+		return;
+	if (ts == 0)
+		ts = netmap_monitor_tstamp();
+	if (mna->snaplen && mna->snaplen < max_len)
+		max_len = mna->snaplen;
+
+	mtx_lock(&mkring->q_lock);
+	i = mkring->nr_hwtail;
+	busy = i - mkring->nr_hwcur;
+	if (busy < 0)
+		busy += mkring->nkr_num_slots;
+	free_slots = mlim - busy;
+
+	for ( ; beg != end; beg = nm_next(beg, lim)) {
+		struct netmap_slot *s = &ring->slot[beg];
+		struct netmap_slot *ms;
+		u_int len;
+
+		if (sm && !netmap_monitor_sample(mna, sm))
+			continue;
+		len = netmap_monitor_match(kring, mna, s);
+		if (len == 0)
+			continue;
+		if (free_slots == 0) {
+			drops++;
+			continue;
+		}
+		if (len > max_len)
+			len = max_len;
+		ms = &mring->slot[i];
+		memcpy(NMB(&mna->up, ms), NMB(kring->na, s), len);
+		ms->len = len;
+		ms->flags = dir;
+		ms->ptr = ts;
+
+		i = nm_next(i, mlim);
+		free_slots--;
+	}
+	if (drops)
+		nm_kr_stats_drop(mkring, NR_DROP_RING_FULL, drops);
+	if (i == mkring->nr_hwtail) {
+		mtx_unlock(&mkring->q_lock);
+		return;
+	}
+	mb();
+	mkring->nr_hwtail = i;
+
+	mtx_unlock(&mkring->q_lock);
+	mna->up.nm_notify(&mna->up, mkring->ring_id,
+		mkring == &mna->up.tx_rings[mkring->ring_id] ? NR_TX : NR_RX, 0);
+}
+
+/* copy monitors see the slots of kring from mon_next up to end, and
+ * then move mon_next to end. Return the first slot to copy, which is
+ * hwcur if mon_next is no longer between hwcur and end (e.g. after
+ * a ring reinit).
+ */
+static inline u_int
+netmap_monitor_next(struct netmap_kring *kring, u_int end)
+{
+	u_int n = kring->nkr_num_slots;
+
+	if (kring->mon_next >= n || (end + n - kring->mon_next) % n >
+			(end + n - kring->nr_hwcur) % n)
+		kring->mon_next = kring->nr_hwcur;
+	return kring->mon_next;
 }
 
-/* callback used to replace the nm_sync callback in the monitored tx rings */
+/* callback used to replace the nm_sync callback in the monitored tx rings.
+ * Copy monitors get the slots submitted by the user, before the
+ * original sync (a pipe master swaps them with its peer), the
+ * zero-copy monitor the ones completed by the NIC.
+ */
 static int
 netmap_monitor_parent_txsync(struct netmap_kring *kring, int flags)
 {
+	u_int hwtail = kring->nr_hwtail, head = kring->rhead;
+	u_int i, beg;
+	int error;
+
         ND("%s %x", kring->name, flags);
-        return netmap_monitor_parent_sync(kring, flags, &kring->nr_hwtail);
+	/* the txsync prologue has validated rhead */
+	if (kring->n_monitors) {
+		beg = netmap_monitor_next(kring, head);
+		for (i = 0; i < kring->n_monitors; i++)
+			netmap_monitor_copy(kring, kring->monitors[i],
+				beg, head, 1);
+		kring->mon_next = head;
+	}
+	error = kring->save_sync(kring, flags);
+	if (error)
+		return error;
+	if (kring->zmon)
+		netmap_monitor_zcopy(kring, kring->zmon,
+			hwtail, kring->nr_hwtail, 1);
+	return 0;
 }
 
-/* callback used to replace the nm_sync callback in the monitored rx rings */
+/* callback used to replace the nm_sync callback in the monitored rx rings.
+ * The zero-copy monitor takes the buffers released by the consumer
+ * before the original sync gives them back to the NIC, copy monitors
+ * get the slots received since the previous rxsync. These are not
+ * only the ones the sync itself brings in: on VALE ports, pipes and
+ * early rx, other contexts move hwtail between the syncs.
+ */
 static int
 netmap_monitor_parent_rxsync(struct netmap_kring *kring, int flags)
 {
+	u_int hwtail = kring->nr_hwtail, n = kring->nkr_num_slots;
+	u_int i, beg;
+	int error;
+
         ND("%s %x", kring->name, flags);
-        return netmap_monitor_parent_sync(kring, flags, &kring->rcur);
+	if (kring->zmon) {
+		/* the rxsync prologue has not run yet, check head here */
+		u_int head = kring->ring->head;
+
+		if (head < n && (head + n - kring->nr_hwcur) % n <=
+				(hwtail + n - kring->nr_hwcur) % n)
+			netmap_monitor_zcopy(kring, kring->zmon,
+				kring->nr_hwcur, head, 0);
+	}
+	error = kring->save_sync(kring, flags);
+	if (error)
+		return error;
+	if (kring->n_monitors == 0)
+		return 0;
+	beg = netmap_monitor_next(kring, kring->nr_hwtail);
+	for (i = 0; i < kring->n_monitors; i++)
+		netmap_monitor_copy(kring, kring->monitors[i],
+			beg, kring->nr_hwtail, 0);
+	kring->mon_next = kring->nr_hwtail;
+	return 0;
+}
+
+/* add mna to the monitors of kring, intercepting its nm_sync if mna
+ * is the first one. The kring must be stopped.
+ */
+static int
+netmap_monitor_add(struct netmap_kring *kring,
+	struct netmap_monitor_adapter *mna, int tx)
+{
+	if (mna->flags & NR_MONITOR_COPY) {
+		/* start from the slots not yet seen by the user */
+		if (kring->n_monitors == 0)
+			kring->mon_next = tx ? kring->nr_hwcur : kring->rtail;
+		if (kring->n_monitors == kring->max_monitors) {
+			u_int n = kring->max_monitors ?
+				2 * kring->max_monitors : 2;
+			struct netmap_monitor_adapter **m;
+
+			m = malloc(n * sizeof(*m), M_DEVBUF, M_NOWAIT | M_ZERO);
+			if (m == NULL)
+				return ENOMEM;
+			if (kring->monitors) {
+				memcpy(m, kring->monitors,
+					kring->n_monitors * sizeof(*m));
+				free(kring->monitors, M_DEVBUF);
+			}
+			kring->monitors = m;
+			kring->max_monitors = n;
+		}
+		kring->monitors[kring->n_monitors++] = mna;
+	} else {
+		kring->zmon = mna;
+	}
+	if (kring->save_sync == NULL) {
+		kring->save_sync = kring->nm_sync;
+		kring->nm_sync = tx ? netmap_monitor_parent_txsync :
+			netmap_monitor_parent_rxsync;
+	}
+	return 0;
+}
+
+/* remove mna from the monitors of kring (if there), and restore
+ * the original nm_sync if it was the last one. The kring must
+ * be stopped.
+ */
+static void
+netmap_monitor_del(struct netmap_kring *kring,
+	struct netmap_monitor_adapter *mna)
+{
+	u_int i;
+
+	if (kring->zmon == mna)
+		kring->zmon = NULL;
+	for (i = 0; i < kring->n_monitors; i++) {
+		if (kring->monitors[i] == mna) {
+			kring->monitors[i] =
+				kring->monitors[--kring->n_monitors];
+			break;
+		}
+	}
+	if (kring->n_monitors == 0 && kring->zmon == NULL &&
+			kring->save_sync != NULL) {
+		kring->nm_sync = kring->save_sync;
+		kring->save_sync = NULL;
+		if (kring->monitors) {
+			free(kring->monitors, M_DEVBUF);
+			kring->monitors = NULL;
+			kring->max_monitors = 0;
+		}
+	}
+}
+
+/* stop, or restart, the rings monitored by mna */
+static void
+netmap_monitor_stop(struct netmap_monitor_adapter *mna, int stopped)
+{
+	struct netmap_priv_d *priv = &mna->priv;
+	struct netmap_adapter *pna = priv->np_na;
+	int i;
+
+	if (!nm_netmap_on(pna))
+		return;
+	if (mna->flags & NR_MONITOR_TX) {
+		for (i = priv->np_txqfirst; i < priv->np_txqlast; i++)
+			netmap_set_txring(pna, i, stopped);
+	}
+	if (mna->flags & NR_MONITOR_RX) {
+		for (i = priv->np_rxqfirst; i < priv->np_rxqlast; i++)
+			netmap_set_rxring(pna, i, stopped);
+	}
+}
+
+/* detach mna from all the rings it monitors */
+static void
+netmap_monitor_del_all(struct netmap_monitor_adapter *mna)
+{
+	struct netmap_priv_d *priv = &mna->priv;
+	struct netmap_adapter *pna = priv->np_na;
+	int i;
+
+	if (mna->flags & NR_MONITOR_TX) {
+		for (i = priv->np_txqfirst; i < priv->np_txqlast; i++) {
+			netmap_set_txring(pna, i, 1 /* stopped */);
+			netmap_monitor_del(&pna->tx_rings[i], mna);
+			netmap_set_txring(pna, i, 0 /* enabled */);
+		}
+	}
+	if (mna->flags & NR_MONITOR_RX) {
+		for (i = priv->np_rxqfirst; i < priv->np_rxqlast; i++) {
+			netmap_set_rxring(pna, i, 1 /* stopped */);
+			netmap_monitor_del(&pna->rx_rings[i], mna);
+			netmap_set_rxring(pna, i, 0 /* enabled */);
+		}
+	}
 }
 
 /* nm_sync callback for the monitor's own tx rings.
- * This makes no sense and always returns error
+ * With NR_MONITOR_SPLIT they get the monitored tx traffic, and are
+ * used like rx rings. Otherwise this makes no sense and always
+ * returns error.
  */
 static int
 netmap_monitor_txsync(struct netmap_kring *kring, int flags)
 {
-        D("%s %x", kring->name, flags);
-	return EIO;
+	struct netmap_monitor_adapter *mna =
+		(struct netmap_monitor_adapter *)kring->na;
+
+        ND("%s %x", kring->name, flags);
+	if (!(mna->flags & NR_MONITOR_SPLIT)) {
+		D("%s %x", kring->name, flags);
+		return EIO;
+	}
+	kring->nr_hwcur = kring->rhead;
+	mb();
+	nm_txsync_finalize(kring);
+	return 0;
 }
 
 /* nm_sync callback for the monitor's own rx rings.
- * Note that the lock in netmap_monitor_parent_sync only protects
- * writers among themselves. Synchronization between writers
+ * Note that the lock in netmap_monitor_zcopy and netmap_monitor_copy
+ * only protects writers among themselves. Synchronization between writers
  * (i.e., netmap_monitor_parent_txsync and netmap_monitor_parent_rxsync)
  * and readers (i.e., netmap_monitor_rxsync) relies on memory barriers.
  */
@@ -237,20 +651,27 @@ netmap_monitor_rxsync(struct netmap_kring *kring, int flags)
 static int
 netmap_monitor_krings_create(struct netmap_adapter *na)
 {
-	return netmap_krings_create(na, 0);
+	struct netmap_monitor_adapter *mna =
+		(struct netmap_monitor_adapter *)na;
+	int i, error;
+
+	error = netmap_krings_create(na, 0);
+	if (error || !(mna->flags & NR_MONITOR_SPLIT))
+		return error;
+	/* the tx rings start empty, as rx rings */
+	for (i = 0; i < na->num_tx_rings + 1; i++)
+		na->tx_rings[i].nr_hwtail = na->tx_rings[i].rtail = 0;
+	return 0;
 }
 
 
 /* nm_register callback for monitors.
  *
- * On registration, replace the nm_sync callbacks in the monitored
- * rings with our own, saving the previous ones in the monitored
- * rings themselves, where they are used by netmap_monitor_parent_sync.
- *
- * On de-registration, restore the original callbacks. We need to
- * stop traffic while we are doing this, since the monitored adapter may
- * have already started executing a netmap_monitor_parent_sync
- * and may not like the kring->save_sync pointer to become NULL.
+ * On registration, add the monitor to the monitored rings. On
+ * de-registration, remove it. We need to stop traffic while we are
+ * doing this, since the monitored adapter may have already started
+ * executing a netmap_monitor_parent_*sync and may not like the
+ * monitor list, or the kring->save_sync pointer, to change.
  */
 static int
 netmap_monitor_reg(struct netmap_adapter *na, int onoff)
@@ -259,8 +680,7 @@ netmap_monitor_reg(struct netmap_adapter *na, int onoff)
 		(struct netmap_monitor_adapter *)na;
 	struct netmap_priv_d *priv = &mna->priv;
 	struct netmap_adapter *pna = priv->np_na;
-	struct netmap_kring *kring;
-	int i;
+	int i, error = 0;
 
 	ND("%p: onoff %d", na, onoff);
 	if (onoff) {
@@ -270,16 +690,22 @@ netmap_monitor_reg(struct netmap_adapter *na, int onoff)
 		}
 		if (mna->flags & NR_MONITOR_TX) {
 			for (i = priv->np_txqfirst; i < priv->np_txqlast; i++) {
-				kring = &pna->tx_rings[i];
-				kring->save_sync = kring->nm_sync;
-				kring->nm_sync = netmap_monitor_parent_txsync;
+				netmap_set_txring(pna, i, 1 /* stopped */);
+				error = netmap_monitor_add(&pna->tx_rings[i],
+						mna, 1);
+				netmap_set_txring(pna, i, 0 /* enabled */);
+				if (error)
+					goto del_all;
 			}
 		}
 		if (mna->flags & NR_MONITOR_RX) {
 			for (i = priv->np_rxqfirst; i < priv->np_rxqlast; i++) {
-				kring = &pna->rx_rings[i];
-				kring->save_sync = kring->nm_sync;
-				kring->nm_sync = netmap_monitor_parent_rxsync;
+				netmap_set_rxring(pna, i, 1 /* stopped */);
+				error = netmap_monitor_add(&pna->rx_rings[i],
+						mna, 0);
+				netmap_set_rxring(pna, i, 0 /* enabled */);
+				if (error)
+					goto del_all;
 			}
 		}
 		na->na_flags |= NAF_NETMAP_ON;
@@ -289,26 +715,13 @@ netmap_monitor_reg(struct netmap_adapter *na, int onoff)
 			return 0;
 		}
 		na->na_flags &= ~NAF_NETMAP_ON;
-		if (mna->flags & NR_MONITOR_TX) {
-			for (i = priv->np_txqfirst; i < priv->np_txqlast; i++) {
-				netmap_set_txring(pna, i, 1 /* stopped */);
-				kring = &pna->tx_rings[i];
-				kring->nm_sync = kring->save_sync;
-				kring->save_sync = NULL;
-				netmap_set_txring(pna, i, 0 /* enabled */);
-			}
-		}
-		if (mna->flags & NR_MONITOR_RX) {
-			for (i = priv->np_rxqfirst; i < priv->np_rxqlast; i++) {
-				netmap_set_rxring(pna, i, 1 /* stopped */);
-				kring = &pna->rx_rings[i];
-				kring->nm_sync = kring->save_sync;
-				kring->save_sync = NULL;
-				netmap_set_rxring(pna, i, 0 /* enabled */);
-			}
-		}
+		netmap_monitor_del_all(mna);
 	}
 	return 0;
+
+del_all:
+	netmap_monitor_del_all(mna);
+	return error;
 }
 /* nm_krings_delete callback for monitors */
 static void
@@ -324,25 +737,94 @@ netmap_monitor_dtor(struct netmap_adapter *na)
 {
 	struct netmap_monitor_adapter *mna =
 		(struct netmap_monitor_adapter *)na;
-	struct netmap_priv_d *priv = &mna->priv;
-	struct netmap_adapter *pna = priv->np_na;
-	int i;
+	struct netmap_adapter *pna = mna->priv.np_na;
 
 	ND("%p", na);
-	if (nm_netmap_on(pna)) {
-		/* parent still in netmap mode, mark its krings as free */
-		if (mna->flags & NR_MONITOR_TX) {
-			for (i = priv->np_txqfirst; i < priv->np_txqlast; i++) {
-				pna->tx_rings[i].monitor = NULL;
-			}
-		}
-		if (mna->flags & NR_MONITOR_RX) {
-			for (i = priv->np_rxqfirst; i < priv->np_rxqlast; i++) {
-				pna->rx_rings[i].monitor = NULL;
-			}
+	/* we left the monitored rings in netmap_monitor_reg() */
+	if (mna->filter)
+		free(mna->filter, M_DEVBUF);
+	if (mna->samplers)
+		free(mna->samplers, M_DEVBUF);
+	netmap_adapter_put(pna);
+}
+
+
+/*
+ * NM_CFG_FILTER: install, or remove, the filter of the monitor bound
+ * to priv. The monitored rings are stopped while we change it.
+ * Called with NMG_LOCK held.
+ */
+int
+netmap_monitor_filter(struct netmap_priv_d *priv, struct nm_filter_req *req)
+{
+	struct netmap_monitor_adapter *mna;
+	struct nm_bpf_insn *f, *old;
+	int error;
+
+	if (priv->np_nifp == NULL)
+		return ENXIO;
+	if (priv->np_na->nm_register != netmap_monitor_reg)
+		return EINVAL; /* not a monitor */
+	mna = (struct netmap_monitor_adapter *)priv->np_na;
+	error = nm_filter_copyin(req, &f);
+	if (error)
+		return error;
+
+	netmap_monitor_stop(mna, 1);
+	old = mna->filter;
+	mna->filter = f;
+	netmap_monitor_stop(mna, 0);
+	if (old)
+		free(old, M_DEVBUF);
+	return 0;
+}
+
+/* NM_CFG_SAMPLE: set the sampling policy of the monitor bound to priv */
+int
+netmap_monitor_sample_config(struct netmap_priv_d *priv,
+	struct nm_sample_req *req)
+{
+	struct netmap_monitor_adapter *mna;
+	struct netmap_adapter *pna;
+	struct nm_sampler *sm = NULL, *old;
+	uint32_t burst = req->nsr_burst ? req->nsr_burst : req->nsr_arg;
+	uint64_t now;
+	u_int i, n;
+
+	if (priv->np_nifp == NULL)
+		return ENXIO;
+	if (priv->np_na->nm_register != netmap_monitor_reg)
+		return EINVAL; /* not a monitor */
+	mna = (struct netmap_monitor_adapter *)priv->np_na;
+	pna = mna->priv.np_na;
+	if (req->nsr_policy > NM_SAMPLE_PPS ||
+	    (req->nsr_policy != NM_SAMPLE_ALL && req->nsr_arg == 0))
+		return EINVAL;
+
+	if (req->nsr_policy != NM_SAMPLE_ALL) {
+		n = pna->num_tx_rings + 1 + pna->num_rx_rings + 1;
+		sm = malloc(n * sizeof(*sm), M_DEVBUF, M_NOWAIT | M_ZERO);
+		if (sm == NULL)
+			return ENOMEM;
+		now = netmap_monitor_tstamp();
+		for (i = 0; i < n; i++) {
+			sm[i].left = req->nsr_policy == NM_SAMPLE_NTH ?
+				req->nsr_arg : burst;
+			sm[i].rnd = ((uint32_t)now ^ (i * 0x9e3779b9)) | 1;
+			sm[i].last = now;
 		}
 	}
-	netmap_adapter_put(pna);
+
+	netmap_monitor_stop(mna, 1);
+	old = mna->samplers;
+	mna->samplers = sm;
+	mna->sample_policy = req->nsr_policy;
+	mna->sample_arg = req->nsr_arg;
+	mna->sample_burst = burst;
+	netmap_monitor_stop(mna, 0);
+	if (old)
+		free(old, M_DEVBUF);
+	return 0;
 }
 
 
@@ -375,7 +857,9 @@ netmap_get_monitor_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 	 * except other monitors.
 	 */
 	memcpy(&pnmr, nmr, sizeof(pnmr));
-	pnmr.nr_flags &= ~(NR_MONITOR_TX | NR_MONITOR_RX);
+	pnmr.nr_flags &= ~(NR_MONITOR_TX | NR_MONITOR_RX | NR_MONITOR_COPY |
+		NR_MONITOR_SPLIT);
+	pnmr.nr_arg1 = 0; /* our snaplen, not a pipe hint */
 	error = netmap_get_na(&pnmr, &pna, create);
 	if (error) {
 		D("parent lookup failed: %d", error);
@@ -400,26 +884,25 @@ netmap_get_monitor_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 		D("ringid error");
 		goto put_out;
 	}
-	if (nmr->nr_flags & NR_MONITOR_TX) {
+	/* only one zero-copy monitor per ring, the copy ones can be many */
+	if ((nmr->nr_flags & NR_MONITOR_TX) &&
+			!(nmr->nr_flags & NR_MONITOR_COPY)) {
 		for (i = mna->priv.np_txqfirst; i < mna->priv.np_txqlast; i++) {
-			struct netmap_kring *kring = &pna->tx_rings[i];
-			if (kring->monitor) {
+			if (pna->tx_rings[i].zmon) {
 				error = EBUSY;
 				D("ring busy");
-				goto release_out;
+				goto put_out;
 			}
-			kring->monitor = mna;
 		}
 	}
-	if (nmr->nr_flags & NR_MONITOR_RX) {
+	if ((nmr->nr_flags & NR_MONITOR_RX) &&
+			!(nmr->nr_flags & NR_MONITOR_COPY)) {
 		for (i = mna->priv.np_rxqfirst; i < mna->priv.np_rxqlast; i++) {
-			struct netmap_kring *kring = &pna->rx_rings[i];
-			if (kring->monitor) {
+			if (pna->rx_rings[i].zmon) {
 				error = EBUSY;
 				D("ring busy");
-				goto release_out;
+				goto put_out;
 			}
-			kring->monitor = mna;
 		}
 	}
 
@@ -433,18 +916,20 @@ netmap_get_monitor_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 	mna->up.nm_dtor = netmap_monitor_dtor;
 	mna->up.nm_krings_create = netmap_monitor_krings_create;
 	mna->up.nm_krings_delete = netmap_monitor_krings_delete;
-	mna->up.nm_mem = pna->nm_mem;
-	mna->up.na_lut = pna->na_lut;
-	mna->up.na_lut_objtotal = pna->na_lut_objtotal;
-	mna->up.na_lut_objsize = pna->na_lut_objsize;
-
-	mna->up.num_tx_rings = 1; // XXX we don't need it, but field can't be zero
-	/* we set the number of our rx_rings to be max(num_rx_rings, num_rx_rings)
-	 * in the parent
-	 */
-	mna->up.num_rx_rings = pna->num_rx_rings;
-	if (pna->num_tx_rings > pna->num_rx_rings)
-		mna->up.num_rx_rings = pna->num_tx_rings;
+
+	if (nmr->nr_flags & NR_MONITOR_SPLIT) {
+		/* one ring for each monitored ring */
+		mna->up.num_tx_rings = pna->num_tx_rings;
+		mna->up.num_rx_rings = pna->num_rx_rings;
+	} else {
+		mna->up.num_tx_rings = 1; // XXX we don't need it, but field can't be zero
+		/* we set the number of our rx_rings to be max(num_rx_rings, num_rx_rings)
+		 * in the parent
+		 */
+		mna->up.num_rx_rings = pna->num_rx_rings;
+		if (pna->num_tx_rings > pna->num_rx_rings)
+			mna->up.num_rx_rings = pna->num_tx_rings;
+	}
 	/* by default, the number of slots is the same as in
 	 * the parent rings, but the user may ask for a different
 	 * number
@@ -455,15 +940,36 @@ netmap_get_monitor_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 	mna->up.num_rx_desc = nmr->nr_rx_slots;
 	nm_bound_var(&mna->up.num_rx_desc, pna->num_rx_desc,
 			1, NM_MONITOR_MAXSLOTS, NULL);
+
+	/* remember the traffic directions we have to monitor */
+	mna->flags = (nmr->nr_flags & (NR_MONITOR_TX | NR_MONITOR_RX |
+		NR_MONITOR_COPY | NR_MONITOR_SPLIT));
+
+	if (mna->flags & NR_MONITOR_COPY) {
+		/* copy monitors do not need the buffers of the parent */
+		mna->snaplen = nmr->nr_arg1;
+		mna->up.nm_mem = netmap_mem_private_new(mna->up.name,
+			mna->up.num_tx_rings, mna->up.num_tx_desc,
+			mna->up.num_rx_rings, mna->up.num_rx_desc,
+			0, 0, &error);
+		if (mna->up.nm_mem == NULL) {
+			D("memory error");
+			goto release_out;
+		}
+		mna->up.na_flags |= NAF_MEM_OWNER;
+	} else {
+		mna->up.nm_mem = pna->nm_mem;
+		mna->up.na_lut = pna->na_lut;
+		mna->up.na_lut_objtotal = pna->na_lut_objtotal;
+		mna->up.na_lut_objsize = pna->na_lut_objsize;
+	}
+
 	error = netmap_attach_common(&mna->up);
 	if (error) {
 		D("attach_common error");
 		goto release_out;
 	}
 
-	/* remember the traffic directions we have to monitor */
-	mna->flags = (nmr->nr_flags & (NR_MONITOR_TX | NR_MONITOR_RX));
-
 	*na = &mna->up;
 	netmap_adapter_get(*na);
 
@@ -472,6 +978,8 @@ netmap_get_monitor_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 	nmr->nr_rx_rings = mna->up.num_rx_rings;
 	nmr->nr_tx_slots = mna->up.num_tx_desc;
 	nmr->nr_rx_slots = mna->up.num_rx_desc;
+	if (mna->flags & NR_MONITOR_COPY)
+		nmr->nr_arg1 = mna->snaplen;
 
 	/* keep the reference to the parent */
 	D("monitor ok");
@@ -480,14 +988,8 @@ netmap_get_monitor_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 
 release_out:
 	D("monitor error");
-	for (i = mna->priv.np_txqfirst; i < mna->priv.np_txqlast; i++) {
-		if (pna->tx_rings[i].monitor == mna)
-			pna->tx_rings[i].monitor = NULL;
-	}
-	for (i = mna->priv.np_rxqfirst; i < mna->priv.np_rxqlast; i++) {
-		if (pna->rx_rings[i].monitor == mna)
-			pna->rx_rings[i].monitor = NULL;
-	}
+	if (mna->up.na_flags & NAF_MEM_OWNER)
+		netmap_mem_private_delete(mna->up.nm_mem);
 put_out:
 	netmap_adapter_put(pna);
 	free(mna, M_DEVBUF);
@@ -71,57 +71,77 @@
 #ifdef WITH_PIPES
 
 #define NM_PIPE_MAXSLOTS	4096
+#define NM_PIPE_MAXGROUP	64	/* slave rings in a pipe group */
 
 int netmap_default_pipes = 0; /* default number of pipes for each nic */
 SYSCTL_DECL(_dev_netmap);
 SYSCTL_INT(_dev_netmap, OID_AUTO, default_pipes, CTLFLAG_RW, &netmap_default_pipes, 0 , "");
+int netmap_pipe_evidx = 1; /* suppress unneeded wakeups, see below */
+SYSCTL_INT(_dev_netmap, OID_AUTO, pipe_evidx, CTLFLAG_RW, &netmap_pipe_evidx, 0 , "");
 
-/* allocate the pipe array in the parent adapter */
+/* smallest pipe table, entries */
+#define NM_PIPE_MINHASH		16
+
+#define NM_PIPE_HASH(id, size)	(((id) * 2654435761U) & ((size) - 1))
+
+/* resize the pipe table of the parent, size is a power of 2 */
+static int
+netmap_pipe_grow(struct netmap_adapter *parent, u_int size)
+{
+	struct nm_pipe_entry *old = parent->na_pipes, *t;
+	u_int i, j;
+
+	t = malloc(size * sizeof(*t), M_DEVBUF, M_NOWAIT | M_ZERO);
+	if (t == NULL)
+		return ENOMEM;
+	for (i = 0; old && i < parent->na_max_pipes; i++) {
+		if (old[i].pna == NULL)
+			continue;
+		for (j = NM_PIPE_HASH(old[i].id, size); t[j].pna;
+				j = (j + 1) & (size - 1))
+			;
+		t[j] = old[i];
+	}
+	parent->na_pipes = t;
+	parent->na_max_pipes = size;
+	if (old)
+		free(old, M_DEVBUF);
+	ND("%s: pipe table now %u entries", parent->name, size);
+	return 0;
+}
+
+/* allocate the pipe table in the parent adapter */
 int
 netmap_pipe_alloc(struct netmap_adapter *na, struct nmreq *nmr)
 {
-	size_t len;
 	int mode = nmr->nr_flags & NR_REG_MASK;
-	u_int npipes;
+	u_int npipes, size;
 
 	if (mode == NR_REG_PIPE_MASTER || mode == NR_REG_PIPE_SLAVE) {
 		/* this is for our parent, not for us */
 		return 0;
 	}
 
-	/* TODO: we can resize the array if the new
-         * request can accomodate the already existing pipes
-         */
-	if (na->na_pipes) {
-		nmr->nr_arg1 = na->na_max_pipes;
-		return 0;
-	}
-
 	npipes = nmr->nr_arg1;
 	if (npipes == 0)
 		npipes = netmap_default_pipes;
 	nm_bound_var(&npipes, 0, 0, NM_MAXPIPES, NULL);
 
-	if (npipes == 0) {
-		/* really zero, nothing to alloc */
-		goto out;
+	/* the table grows as needed, npipes is only a hint
+	 * for the initial size
+	 */
+	if (na->na_pipes == NULL && npipes > 0) {
+		for (size = NM_PIPE_MINHASH; size < 2 * npipes; size *= 2)
+			;
+		if (netmap_pipe_grow(na, size))
+			return ENOMEM;
 	}
-
-	len = sizeof(struct netmap_pipe_adapter *) * npipes;
-	na->na_pipes = malloc(len, M_DEVBUF, M_NOWAIT | M_ZERO);
-	if (na->na_pipes == NULL)
-		return ENOMEM;
-
-	na->na_max_pipes = npipes;
-	na->na_next_pipe = 0;
-
-out:
 	nmr->nr_arg1 = npipes;
 
 	return 0;
 }
 
-/* deallocate the parent array in the parent adapter */
+/* deallocate the pipe table in the parent adapter */
 void
 netmap_pipe_dealloc(struct netmap_adapter *na)
 {
@@ -134,48 +154,118 @@ netmap_pipe_dealloc(struct netmap_adapter *na)
 	}
 }
 
-/* find a pipe endpoint with the given id among the parent's pipes */
+/* index of the entry for pipe_id in the parent table, or -1 */
+static int
+netmap_pipe_lookup(struct netmap_adapter *parent, u_int pipe_id)
+{
+	u_int mask = parent->na_max_pipes - 1, i;
+
+	if (parent->na_pipes == NULL)
+		return -1;
+	for (i = NM_PIPE_HASH(pipe_id, parent->na_max_pipes);
+			parent->na_pipes[i].pna; i = (i + 1) & mask) {
+		if (parent->na_pipes[i].id == pipe_id)
+			return i;
+	}
+	return -1;
+}
+
+/* find a pipe endpoint with the given id among the parent's pipes,
+ * the ids of a group all map to the same pipe
+ */
 static struct netmap_pipe_adapter *
 netmap_pipe_find(struct netmap_adapter *parent, u_int pipe_id)
 {
-	int i;
-	struct netmap_pipe_adapter *na;
+	int i = netmap_pipe_lookup(parent, pipe_id);
 
-	for (i = 0; i < parent->na_next_pipe; i++) {
-		na = parent->na_pipes[i];
-		if (na->id == pipe_id) {
-			return na;
-		}
-	}
-	return NULL;
+	return i < 0 ? NULL : parent->na_pipes[i].pna;
 }
 
-/* add a new pipe endpoint to the parent array */
+/* add a new pipe endpoint, with all its ids, to the parent table */
 static int
 netmap_pipe_add(struct netmap_adapter *parent, struct netmap_pipe_adapter *na)
 {
-	if (parent->na_next_pipe >= parent->na_max_pipes) {
-		D("%s: no space left for pipes", parent->name);
-		return ENOMEM;
+	u_int i, j, mask;
+
+	/* private allocators (VALE ports) only reserved rings
+	 * for na_pipe_space pipes when they were created
+	 */
+	if (parent->na_pipe_space && parent->na_next_pipe + na->group >
+			(u_int)parent->na_pipe_space) {
+		D("%s: only %d pipes fit in the memory of the port",
+			parent->name, parent->na_pipe_space);
+		return ENOSPC;
 	}
-
-	parent->na_pipes[parent->na_next_pipe] = na;
-	na->parent_slot = parent->na_next_pipe;
-	parent->na_next_pipe++;
+	while (2 * (parent->na_next_pipe + na->group) >
+			(u_int)parent->na_max_pipes) {
+		if (netmap_pipe_grow(parent, parent->na_max_pipes ?
+				2 * parent->na_max_pipes : NM_PIPE_MINHASH)) {
+			D("%s: no space left for pipes", parent->name);
+			return ENOMEM;
+		}
+	}
+	mask = parent->na_max_pipes - 1;
+	for (i = 0; i < na->group; i++) {
+		for (j = NM_PIPE_HASH(na->id + i, parent->na_max_pipes);
+				parent->na_pipes[j].pna; j = (j + 1) & mask)
+			;
+		parent->na_pipes[j].id = na->id + i;
+		parent->na_pipes[j].pna = na;
+	}
+	parent->na_next_pipe += na->group;
 	return 0;
 }
 
-/* remove the given pipe endpoint from the parent array */
+/* remove the given pipe endpoint from the parent table */
 static void
 netmap_pipe_remove(struct netmap_adapter *parent, struct netmap_pipe_adapter *na)
 {
-	u_int n;
-	n = --parent->na_next_pipe;
-	if (n != na->parent_slot) {
-		parent->na_pipes[na->parent_slot] =
-			parent->na_pipes[n];
+	struct nm_pipe_entry *t = parent->na_pipes;
+	u_int mask = parent->na_max_pipes - 1;
+	u_int g, h, j;
+	int i;
+
+	for (g = 0; g < na->group; g++) {
+		i = netmap_pipe_lookup(parent, na->id + g);
+		if (i < 0)
+			continue;
+		t[i].pna = NULL;
+		/* move back the entries that would not be found anymore */
+		for (j = (i + 1) & mask; t[j].pna; j = (j + 1) & mask) {
+			h = NM_PIPE_HASH(t[j].id, parent->na_max_pipes);
+			if (((j - h) & mask) >= ((j - i) & mask)) {
+				t[i] = t[j];
+				t[j].pna = NULL;
+				i = j;
+			}
+		}
+		parent->na_next_pipe--;
 	}
-	parent->na_pipes[n] = NULL;
+}
+
+/*
+ * Notification suppression, as in the virtio event index.
+ * The reader of an rx ring is woken up only when the new slots
+ * reach its rcur (the ring->cur of its last rxsync), i.e. when it
+ * has seen all the slots before and may be sleeping. The writer
+ * publishes in nkr_pipe_event of the peer rx ring the slot whose
+ * release makes it worth a wakeup: nothing if it is not blocked,
+ * half a ring if it is waiting for space. A reader that releases
+ * slots and has nothing left to read always wakes up the writer,
+ * so that the two never wait for each other.
+ * With dev.netmap.pipe_evidx=0 every sync that moves slots
+ * wakes up the other end, as a reference for measurements.
+ */
+#define NM_PIPE_EV_NONE	(~0U)		/* writer not interested */
+#define NM_PIPE_EV_ANY	(~0U - 1)	/* wake up on every release */
+
+/* true if moving from old to new crosses ev, on a ring of n slots,
+ * or if the suppression is disabled
+ */
+static inline int
+nm_pipe_crossed(u_int ev, u_int old, u_int new, u_int n)
+{
+	return !netmap_pipe_evidx || (ev + n - old) % n < (new + n - old) % n;
 }
 
 static int
@@ -186,12 +276,13 @@ netmap_pipe_txsync(struct netmap_kring *txkring, int flags)
         u_int j, k, lim_tx = txkring->nkr_num_slots - 1,
                 lim_rx = rxkring->nkr_num_slots - 1;
         int m, busy;
+	u_int oldtail;
 
         ND("%p: %s %x -> %s", txkring, txkring->name, flags, rxkring->name);
         ND(2, "before: hwcur %d hwtail %d cur %d head %d tail %d", txkring->nr_hwcur, txkring->nr_hwtail,
                 txkring->rcur, txkring->rhead, txkring->rtail);
 
-        j = rxkring->nr_hwtail; /* RX */
+        j = oldtail = rxkring->nr_hwtail; /* RX */
         k = txkring->nr_hwcur;  /* TX */
         m = txkring->rhead - txkring->nr_hwcur; /* new slots */
         if (m < 0)
@@ -208,6 +299,12 @@ netmap_pipe_txsync(struct netmap_kring *txkring, int flags)
 
 	if (limit == 0) {
 		/* either the rxring is full, or nothing to send */
+		if (k != txkring->rhead) {
+			/* full, ask for a wakeup */
+			rxkring->nkr_pipe_event = (rxkring->nr_hwcur +
+				(lim_rx + 1) / 2) % (lim_rx + 1);
+			mb(); /* paired with the mb() in rxsync */
+		}
 		nm_txsync_finalize(txkring); /* actually useless */
 		return 0;
 	}
@@ -232,17 +329,333 @@ netmap_pipe_txsync(struct netmap_kring *txkring, int flags)
         rxkring->nr_hwtail = j;
         txkring->nr_hwcur = k;
         txkring->nr_hwtail = nm_prev(k, lim_tx);
+	/* if the rx ring filled up, wake us up when half of it is free */
+	rxkring->nkr_pipe_event = (k == txkring->rhead) ? NM_PIPE_EV_NONE :
+		(rxkring->nr_hwcur + (lim_rx + 1) / 2) % (lim_rx + 1);
 
         nm_txsync_finalize(txkring);
         ND(2, "after: hwcur %d hwtail %d cur %d head %d tail %d j %d", txkring->nr_hwcur, txkring->nr_hwtail,
                 txkring->rcur, txkring->rhead, txkring->rtail, j);
 
         mb(); /* make sure rxkring->nr_hwtail is updated before notifying */
-        rxkring->na->nm_notify(rxkring->na, rxkring->ring_id, NR_RX, 0);
+	if (nm_pipe_crossed(rxkring->rcur, oldtail, j, lim_rx + 1))
+		rxkring->na->nm_notify(rxkring->na, rxkring->ring_id, NR_RX, 0);
+
+	return 0;
+}
+
+static int netmap_pipe_reg(struct netmap_adapter *na, int onoff);
+
+/*
+ * txsync of the master of a pipe group. Each slot is swapped, as in
+ * netmap_pipe_txsync(), into the slave rx ring selected by the flow
+ * hash of the frame (symmetric, so both directions of a connection
+ * go to the same ring) or round robin. Slots for a full ring are
+ * dropped and counted in the statistics of that ring.
+ */
+static int
+netmap_pipe_lb_txsync(struct netmap_kring *txkring, int flags)
+{
+	struct netmap_pipe_adapter *pna =
+		(struct netmap_pipe_adapter *)txkring->na;
+	struct netmap_adapter *ona = &pna->peer->up;
+	u_int n = ona->num_rx_rings;
+	u_int lim_tx = txkring->nkr_num_slots - 1;
+	u_int k = txkring->nr_hwcur, head = txkring->rhead;
+	u_int tail[NM_PIPE_MAXGROUP], old[NM_PIPE_MAXGROUP];
+	uint64_t seen = 0, moved = 0;
+	u_int r;
+
+	for (; k != head; k = nm_next(k, lim_tx)) {
+		struct netmap_slot *ts = &txkring->ring->slot[k];
+		struct netmap_kring *rxkring;
+		struct netmap_slot *rs, tmp;
+		u_int len = ts->len;
+
+		if (pna->lb_rr) {
+			r = pna->lb_next;
+			pna->lb_next = (r + 1 < n) ? r + 1 : 0;
+		} else {
+			if (len > NETMAP_BUF_SIZE(txkring->na))
+				len = NETMAP_BUF_SIZE(txkring->na);
+			r = nm_rss_hash(NULL, NMB(txkring->na, ts), len) % n;
+		}
+		rxkring = &ona->rx_rings[r];
+		if (!(seen & (1ULL << r))) {
+			seen |= 1ULL << r;
+			tail[r] = old[r] = rxkring->nr_hwtail;
+			/* we drop rather than wait */
+			rxkring->nkr_pipe_event = NM_PIPE_EV_NONE;
+		}
+		if (nm_next(tail[r], rxkring->nkr_num_slots - 1) ==
+				rxkring->nr_hwcur) {
+			nm_kr_stats_drop(rxkring, NR_DROP_RING_FULL, 1);
+			continue;
+		}
+		/* swap the slots */
+		rs = &rxkring->save_ring->slot[tail[r]];
+		tmp = *rs;
+		*rs = *ts;
+		*ts = tmp;
+		tail[r] = nm_next(tail[r], rxkring->nkr_num_slots - 1);
+		moved |= 1ULL << r;
+	}
+
+	mb(); /* make sure the slots are updated before publishing them */
+	for (r = 0; r < n; r++) {
+		if (moved & (1ULL << r))
+			ona->rx_rings[r].nr_hwtail = tail[r];
+	}
+	txkring->nr_hwcur = k;
+	txkring->nr_hwtail = nm_prev(k, lim_tx);
+	nm_txsync_finalize(txkring);
+
+	mb(); /* make sure the nr_hwtail are updated before notifying */
+	for (r = 0; r < n; r++) {
+		struct netmap_kring *rxkring = &ona->rx_rings[r];
+
+		if ((moved & (1ULL << r)) && nm_pipe_crossed(rxkring->rcur,
+				old[r], tail[r], rxkring->nkr_num_slots))
+			ona->nm_notify(ona, r, NR_RX, 0);
+	}
+	return 0;
+}
+
+/*
+ * txsync of the master of a tee pipe group. Every slave rx ring gets
+ * the buffer of each tx slot, without copies: the tx slot goes back
+ * to the master only when all the slaves have released it. A slave
+ * with a full ring either misses the slot (counted as a drop) or,
+ * with tee_block, stops the master. Without tee_block a slave with
+ * a full ring does not hold master slots either: the slots it holds
+ * are taken back (marked NM_PIPE_TEE_REVOKED, and counted as drops),
+ * and the master may reuse their buffers while the slave still reads
+ * them. The slaves must not swap the buffers they receive, see
+ * netmap_pipe_tee_release().
+ */
+#define NM_PIPE_TEE_REVOKED	(~0U)	/* master slot taken back */
+
+static int
+netmap_pipe_tee_txsync(struct netmap_kring *txkring, int flags)
+{
+	struct netmap_pipe_adapter *pna =
+		(struct netmap_pipe_adapter *)txkring->na;
+	struct netmap_adapter *ona = &pna->peer->up;
+	u_int n = ona->num_rx_rings;
+	u_int lim_tx = txkring->nkr_num_slots - 1;
+	u_int k = txkring->nr_hwcur, head = txkring->rhead;
+	u_int ntc = nm_next(txkring->nr_hwtail, lim_tx);
+	u_int tail[NM_PIPE_MAXGROUP], old[NM_PIPE_MAXGROUP], held;
+	uint64_t moved = 0;
+	u_int r;
+
+	for (r = 0; r < n; r++)
+		tail[r] = old[r] = ona->rx_rings[r].nr_hwtail;
+
+	for (; k != head; k = nm_next(k, lim_tx)) {
+		struct netmap_slot *ts = &txkring->ring->slot[k];
+
+		if (pna->tee_block) {
+			for (r = 0; r < n; r++) {
+				struct netmap_kring *rxkring = &ona->rx_rings[r];
+
+				if (nm_next(tail[r], rxkring->nkr_num_slots - 1) ==
+						rxkring->nr_hwcur)
+					break;
+			}
+			if (r < n)
+				break; /* wait for the slowest slave */
+		}
+		for (r = 0; r < n; r++) {
+			struct netmap_kring *rxkring = &ona->rx_rings[r];
+			u_int lim_rx = rxkring->nkr_num_slots - 1;
+			struct netmap_slot *rs;
+
+			if (nm_next(tail[r], lim_rx) == rxkring->nr_hwcur) {
+				nm_kr_stats_drop(rxkring, NR_DROP_RING_FULL, 1);
+				continue;
+			}
+			rs = &rxkring->save_ring->slot[tail[r]];
+			rs->buf_idx = ts->buf_idx;
+			rs->len = ts->len;
+			rs->flags = NS_BUF_CHANGED;
+			rxkring->nkr_tee_buf[lim_rx + 1 + tail[r]] = k;
+			rxkring->nkr_tee_buf[2 * (lim_rx + 1) + tail[r]] =
+				ts->buf_idx;
+			tail[r] = nm_next(tail[r], lim_rx);
+			moved |= 1ULL << r;
+		}
+	}
+
+	mb(); /* make sure the slots are updated before publishing them */
+	for (r = 0; r < n; r++) {
+		if (moved & (1ULL << r))
+			ona->rx_rings[r].nr_hwtail = tail[r];
+	}
+	txkring->nr_hwcur = k;
+
+	/* the master gets back the slots before the oldest one
+	 * still held by a slave
+	 */
+	held = (k + lim_tx + 1 - ntc) % (lim_tx + 1);
+	for (r = 0; r < n; r++) {
+		struct netmap_kring *rxkring = &ona->rx_rings[r];
+		u_int lim_rx = rxkring->nkr_num_slots - 1;
+		uint32_t *tx_slot = rxkring->nkr_tee_buf + lim_rx + 1;
+		u_int hwcur = rxkring->nr_hwcur, j, d;
+
+		if (!pna->tee_block && nm_next(tail[r], lim_rx) == hwcur) {
+			/* full slave, take back its slots, newest first
+			 * up to the ones already taken back
+			 */
+			u_int revoked = 0;
+
+			j = tail[r];
+			do {
+				j = nm_prev(j, lim_rx);
+				if (tx_slot[j] == NM_PIPE_TEE_REVOKED)
+					break;
+				tx_slot[j] = NM_PIPE_TEE_REVOKED;
+				revoked++;
+			} while (j != hwcur);
+			if (revoked)
+				nm_kr_stats_drop(rxkring, NR_DROP_RING_FULL,
+					revoked);
+			continue;
+		}
+		for (j = hwcur; j != tail[r] &&
+				tx_slot[j] == NM_PIPE_TEE_REVOKED;
+				j = nm_next(j, lim_rx))
+			;
+		if (j == tail[r])
+			continue; /* nothing held */
+		d = (tx_slot[j] + lim_tx + 1 - ntc) % (lim_tx + 1);
+		if (d < held)
+			held = d;
+	}
+	txkring->nr_hwtail = nm_prev((ntc + held) % (lim_tx + 1), lim_tx);
+	nm_txsync_finalize(txkring);
+
+	mb(); /* make sure the nr_hwtail are updated before notifying */
+	for (r = 0; r < n; r++) {
+		struct netmap_kring *rxkring = &ona->rx_rings[r];
 
+		if ((moved & (1ULL << r)) && nm_pipe_crossed(rxkring->rcur,
+				old[r], tail[r], rxkring->nkr_num_slots))
+			ona->nm_notify(ona, r, NR_RX, 0);
+	}
 	return 0;
 }
 
+/* save the own buffers of the rx rings of a tee slave */
+static int
+netmap_pipe_tee_init(struct netmap_adapter *na)
+{
+	u_int i, j;
+
+	for (i = 0; i < na->num_rx_rings; i++) {
+		struct netmap_kring *kring = &na->rx_rings[i];
+		u_int n = kring->nkr_num_slots;
+
+		kring->nkr_tee_buf = malloc(3 * n * sizeof(uint32_t),
+				M_DEVBUF, M_NOWAIT | M_ZERO);
+		if (kring->nkr_tee_buf == NULL)
+			return ENOMEM;
+		for (j = 0; j < n; j++)
+			kring->nkr_tee_buf[j] = kring->save_ring->slot[j].buf_idx;
+	}
+	return 0;
+}
+
+/* give the rx rings of a tee slave their buffers back */
+static void
+netmap_pipe_tee_restore(struct netmap_adapter *na)
+{
+	u_int i, j;
+
+	for (i = 0; i < na->num_rx_rings; i++) {
+		struct netmap_kring *kring = &na->rx_rings[i];
+
+		if (kring->nkr_tee_buf == NULL || kring->save_ring == NULL)
+			continue;
+		for (j = 0; j < kring->nkr_num_slots; j++)
+			kring->save_ring->slot[j].buf_idx = kring->nkr_tee_buf[j];
+	}
+}
+
+static void
+netmap_pipe_tee_fini(struct netmap_adapter *na)
+{
+	u_int i;
+
+	if (na->rx_rings == NULL)
+		return;
+	for (i = 0; i < na->num_rx_rings; i++) {
+		struct netmap_kring *kring = &na->rx_rings[i];
+
+		if (kring->nkr_tee_buf) {
+			free(kring->nkr_tee_buf, M_DEVBUF);
+			kring->nkr_tee_buf = NULL;
+		}
+	}
+}
+
+/*
+ * In a pipe group, the slave endpoint with id pipe_id only owns
+ * one ring pair. Return its index, or -1 for all the rings.
+ */
+int
+netmap_pipe_group_ring(struct netmap_adapter *na, u_int pipe_id)
+{
+	struct netmap_pipe_adapter *pna =
+		(struct netmap_pipe_adapter *)na;
+
+	if (na->nm_register != netmap_pipe_reg || pna->group <= 1 ||
+			pipe_id - pna->id >= pna->group)
+		return -1;
+	return pipe_id - pna->id;
+}
+
+/*
+ * Check the slots released by a tee slave. Their buffers belong to
+ * the master and are shared with the other slaves, so the slaves
+ * must not swap them: a release that returns a different buffer is
+ * refused and the ring is reset to nr_hwcur. If the slot holds the
+ * buffer the slave owns for it (set aside in nkr_tee_buf, and in no
+ * ring) the published buffer is put back; any other buffer is left
+ * there, and the slave has to put the published one back itself.
+ */
+static int
+netmap_pipe_tee_release(struct netmap_kring *rxkring, u_int head)
+{
+	struct netmap_ring *ring = rxkring->save_ring;
+	u_int n = rxkring->nkr_num_slots;
+	u_int lim_rx = n - 1;
+	u_int j;
+	int error = 0;
+
+	for (j = rxkring->nr_hwcur; j != head; j = nm_next(j, lim_rx)) {
+		struct netmap_slot *rs = &ring->slot[j];
+		uint32_t buf_idx = rxkring->nkr_tee_buf[2 * n + j];
+
+		if (likely(rs->buf_idx == buf_idx))
+			continue;
+		RD(5, "%s: slot %u has buffer %u instead of %u",
+			rxkring->name, j, rs->buf_idx, buf_idx);
+		if (rs->buf_idx == rxkring->nkr_tee_buf[j]) {
+			rs->buf_idx = buf_idx;
+			rs->flags |= NS_BUF_CHANGED;
+		}
+		error = EINVAL;
+	}
+	if (error) {
+		ring->head = rxkring->rhead = rxkring->nr_hwcur;
+		ring->cur  = rxkring->rcur  = rxkring->nr_hwcur;
+		ring->tail = rxkring->rtail = rxkring->nr_hwtail;
+	}
+	return error;
+}
+
 static int
 netmap_pipe_rxsync(struct netmap_kring *rxkring, int flags)
 {
@@ -250,6 +663,12 @@ netmap_pipe_rxsync(struct netmap_kring *rxkring, int flags)
 	uint32_t oldhwcur = rxkring->nr_hwcur;
 
         ND("%s %x <- %s", rxkring->name, flags, txkring->name);
+	if (rxkring->nkr_tee_buf) {
+		int error = netmap_pipe_tee_release(rxkring, rxkring->rhead);
+
+		if (error)
+			return error;
+	}
         rxkring->nr_hwcur = rxkring->rhead; /* recover user-relased slots */
         ND(5, "hwcur %d hwtail %d cur %d head %d tail %d", rxkring->nr_hwcur, rxkring->nr_hwtail,
                 rxkring->rcur, rxkring->rhead, rxkring->rtail);
@@ -257,9 +676,18 @@ netmap_pipe_rxsync(struct netmap_kring *rxkring, int flags)
         nm_rxsync_finalize(rxkring);
 
 	if (oldhwcur != rxkring->nr_hwcur) {
-		/* we have released some slots, notify the other end */
+		/* we have released some slots, notify the other end
+		 * if it asked for it, or if we are going to sleep
+		 */
+		u_int ev;
+
 		mb(); /* make sure nr_hwcur is updated before notifying */
-		txkring->na->nm_notify(txkring->na, txkring->ring_id, NR_TX, 0);
+		ev = rxkring->nkr_pipe_event;
+		if (!netmap_pipe_evidx || ev == NM_PIPE_EV_ANY ||
+		    rxkring->rcur == rxkring->rtail ||
+		    (ev != NM_PIPE_EV_NONE && nm_pipe_crossed(ev, oldhwcur,
+				rxkring->nr_hwcur, rxkring->nkr_num_slots)))
+			txkring->na->nm_notify(txkring->na, txkring->ring_id, NR_TX, 0);
 	}
         return 0;
 }
@@ -293,6 +721,19 @@ netmap_pipe_rxsync(struct netmap_kring *rxkring, int flags)
  */
 
 
+static void
+netmap_pipe_link(struct netmap_adapter *na, struct netmap_adapter *ona)
+{
+	u_int i;
+
+	for (i = 0; i < na->num_tx_rings; i++)
+		na->tx_rings[i].pipe = ona->rx_rings +
+			(i < ona->num_rx_rings ? i : 0);
+	for (i = 0; i < na->num_rx_rings; i++)
+		na->rx_rings[i].pipe = ona->tx_rings +
+			(i < ona->num_tx_rings ? i : 0);
+}
+
 /* netmap_pipe_krings_delete.
  *
  * There are two cases:
@@ -357,12 +798,24 @@ netmap_pipe_krings_create(struct netmap_adapter *na)
 		for (i = 0; i < ona->num_rx_rings + 1; i++)
 			ona->rx_rings[i].save_ring = ona->rx_rings[i].ring;
 
-		/* cross link the krings */
-		for (i = 0; i < na->num_tx_rings; i++) {
-			na->tx_rings[i].pipe = pna->peer->up.rx_rings + i;
-			na->rx_rings[i].pipe = pna->peer->up.tx_rings + i;
-			pna->peer->up.tx_rings[i].pipe = na->rx_rings + i;
-			pna->peer->up.rx_rings[i].pipe = na->tx_rings + i;
+		/* cross link the krings. In a group the master has
+		 * one tx ring, linked to the first slave rx ring, and
+		 * all the slave rx rings are linked to it.
+		 */
+		netmap_pipe_link(na, ona);
+		netmap_pipe_link(ona, na);
+
+		/* until a writer says otherwise */
+		for (i = 0; i < na->num_rx_rings; i++)
+			na->rx_rings[i].nkr_pipe_event = NM_PIPE_EV_ANY;
+		for (i = 0; i < ona->num_rx_rings; i++)
+			ona->rx_rings[i].nkr_pipe_event = NM_PIPE_EV_ANY;
+
+		if (pna->tee) {
+			error = netmap_pipe_tee_init(pna->role ==
+				NR_REG_PIPE_SLAVE ? na : ona);
+			if (error)
+				goto del_tee;
 		}
 	} else {
 		int i;
@@ -376,6 +829,9 @@ netmap_pipe_krings_create(struct netmap_adapter *na)
 	}
 	return 0;
 
+del_tee:
+	netmap_pipe_tee_fini(pna->role == NR_REG_PIPE_SLAVE ? na : ona);
+	netmap_mem_rings_delete(ona);
 del_krings2:
 	netmap_krings_delete(ona);
 del_rings1:
@@ -431,6 +887,10 @@ netmap_pipe_reg(struct netmap_adapter *na, int onoff)
 	}
 	if (pna->peer_ref) {
 		ND("%p: case 1.a or 2.a, nothing to do", na);
+		/* on 2.a the rings are going away */
+		if (!onoff && pna->tee)
+			netmap_pipe_tee_restore(pna->role ==
+				NR_REG_PIPE_SLAVE ? na : &pna->peer->up);
 		return 0;
 	}
 	if (onoff) {
@@ -488,6 +948,9 @@ netmap_pipe_krings_delete(struct netmap_adapter *na)
 	}
 	/* case 1) above */
 	ND("%p: case 1, deleting everyhing", na);
+	if (pna->tee)
+		netmap_pipe_tee_fini(pna->role == NR_REG_PIPE_SLAVE ?
+			na : &pna->peer->up);
 	netmap_krings_delete(na); /* also zeroes tx_rings etc. */
 	/* restore the ring to be deleted on the peer */
 	ona = &pna->peer->up;
@@ -528,7 +991,7 @@ netmap_get_pipe_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 	struct nmreq pnmr;
 	struct netmap_adapter *pna; /* parent adapter */
 	struct netmap_pipe_adapter *mna, *sna, *req;
-	u_int pipe_id;
+	u_int pipe_id, group, i;
 	int role = nmr->nr_flags & NR_REG_MASK;
 	int error;
 
@@ -563,11 +1026,16 @@ netmap_get_pipe_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 	pipe_id = nmr->nr_ringid & NETMAP_RING_MASK;
 	mna = netmap_pipe_find(pna, pipe_id);
 	if (mna) {
+		if (pipe_id != mna->id && role == NR_REG_PIPE_MASTER) {
+			ND("%d is a slave of group %d", pipe_id, mna->id);
+			error = ENODEV;
+			goto put_out;
+		}
 		if (mna->role == role) {
-			ND("found %d directly at %d", pipe_id, mna->parent_slot);
+			ND("found %d directly", pipe_id);
 			req = mna;
 		} else {
-			ND("found %d indirectly at %d", pipe_id, mna->parent_slot);
+			ND("found %d indirectly", pipe_id);
 			req = mna->peer;
 		}
 		/* the pipe we have found already holds a ref to the parent,
@@ -581,6 +1049,23 @@ netmap_get_pipe_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 		error = ENODEV;
 		goto put_out;
 	}
+	group = 1;
+	if (nmr->nr_flags & NR_PIPE_GROUP) {
+		group = nmr->nr_rx_rings;
+		if (group < 1 || group > NM_PIPE_MAXGROUP ||
+				pipe_id + group - 1 > NETMAP_RING_MASK) {
+			error = EINVAL;
+			goto put_out;
+		}
+		for (i = 1; i < group; i++) {
+			if (netmap_pipe_find(pna, pipe_id + i)) {
+				D("%s: pipe %d already in use", pna->name,
+					pipe_id + i);
+				error = EEXIST;
+				goto put_out;
+			}
+		}
+	}
 	/* we create both master and slave.
          * The endpoint we were asked for holds a reference to
          * the other one.
@@ -595,8 +1080,17 @@ netmap_get_pipe_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 	mna->id = pipe_id;
 	mna->role = NR_REG_PIPE_MASTER;
 	mna->parent = pna;
-
-	mna->up.nm_txsync = netmap_pipe_txsync;
+	mna->group = group;
+	mna->lb_rr = (nmr->nr_flags & NR_PIPE_RR) != 0;
+	mna->tee = (nmr->nr_flags & NR_PIPE_TEE) != 0;
+	mna->tee_block = (nmr->nr_flags & NR_PIPE_BLOCK) != 0;
+
+	if (mna->tee)
+		mna->up.nm_txsync = netmap_pipe_tee_txsync;
+	else if (group > 1)
+		mna->up.nm_txsync = netmap_pipe_lb_txsync;
+	else
+		mna->up.nm_txsync = netmap_pipe_txsync;
 	mna->up.nm_rxsync = netmap_pipe_rxsync;
 	mna->up.nm_register = netmap_pipe_reg;
 	mna->up.nm_dtor = netmap_pipe_dtor;
@@ -608,7 +1102,7 @@ netmap_get_pipe_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 	mna->up.na_lut_objsize = pna->na_lut_objsize;
 
 	mna->up.num_tx_rings = 1;
-	mna->up.num_rx_rings = 1;
+	mna->up.num_rx_rings = group;
 	mna->up.num_tx_desc = nmr->nr_tx_slots;
 	nm_bound_var(&mna->up.num_tx_desc, pna->num_tx_desc,
 			1, NM_PIPE_MAXSLOTS, NULL);
@@ -633,6 +1127,8 @@ netmap_get_pipe_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 	*sna = *mna;
 	snprintf(sna->up.name, sizeof(sna->up.name), "%s}%d", pna->name, pipe_id);
 	sna->role = NR_REG_PIPE_SLAVE;
+	sna->up.num_tx_rings = group;
+	sna->up.nm_txsync = netmap_pipe_txsync;
 	error = netmap_attach_common(&sna->up);
 	if (error)
 		goto free_sna;
@@ -138,6 +138,15 @@ __FBSDID("$FreeBSD: head/sys/dev/netmap/netmap.c 257176 2013-10-26 17:58:36Z gle
 #define NM_BDG_MAXSLOTS		4096	/* XXX same as above */
 #define NM_BRIDGE_RINGSIZE	1024	/* in the device */
 #define NM_BDG_HASH		1024	/* forwarding table entries */
+#ifdef WITH_PIPES
+/* Pipes of a port, which reserves their rings in its private memory
+ * when created. The buffers also have to fit in the allocator,
+ * so many pipes require short rings.
+ */
+#define NM_BDG_MAXPIPES		1024
+#else
+#define NM_BDG_MAXPIPES		0
+#endif /* WITH_PIPES */
 #define NM_BDG_BATCH		1024	/* entries in the forwarding buffer */
 #define NM_MULTISEG		64	/* max size of a chain of bufs */
 /* actual size of the tables */
@@ -223,6 +232,13 @@ struct nm_bridge {
 	 */
 	struct nm_hash_ent ht[NM_BDG_HASH];
 
+	/* the tap (NR_BDG_TAP) gets a copy of the frames in nm_bdg_flush(),
+	 * if they pass bdg_tap_filter. Both are protected by bdg_lock.
+	 * The tap keeps the bridge alive even without ports.
+	 */
+	struct netmap_vp_adapter *bdg_tap;
+	struct nm_bpf_insn *bdg_tap_filter;
+
 #ifdef CONFIG_NET_NS
 	struct net *ns;
 #endif /* CONFIG_NET_NS */
@@ -316,7 +332,7 @@ nm_find_bridge(const char *name, int create)
 	for (i = 0; i < num_bridges; i++) {
 		struct nm_bridge *x = bridges + i;
 
-		if (x->bdg_active_ports == 0) {
+		if (x->bdg_active_ports == 0 && x->bdg_tap == NULL) {
 			if (create && b == NULL)
 				b = x;	/* record empty slot */
 		} else if (x->bdg_namelen != namelen) {
@@ -465,7 +481,7 @@ netmap_bdg_detach_common(struct nm_bridge *b, int hw, int sw)
 	BDG_WUNLOCK(b);
 
 	ND("now %d active ports", lim);
-	if (lim == 0) {
+	if (lim == 0 && b->bdg_tap == NULL) {
 		ND("marking bridge %s as free", b->bdg_basename);
 		bzero(&b->bdg_ops, sizeof(b->bdg_ops));
 		NM_BNS_PUT(b);
@@ -594,6 +610,110 @@ nm_vi_create(struct nmreq *nmr)
 	return 0;
 }
 
+/* nm_register callback for the switch tap. Flipping NAF_NETMAP_ON
+ * under the bridge lock keeps nm_bdg_flush() away from the rings
+ * while they are created or destroyed.
+ */
+static int
+netmap_bdg_tap_reg(struct netmap_adapter *na, int onoff)
+{
+	struct nm_bridge *b = ((struct netmap_vp_adapter *)na)->tap_bdg;
+
+	BDG_WLOCK(b);
+	if (onoff)
+		na->na_flags |= NAF_NETMAP_ON;
+	else
+		na->na_flags &= ~NAF_NETMAP_ON;
+	BDG_WUNLOCK(b);
+	return 0;
+}
+
+/* nm_dtor callback for the switch tap */
+static void
+netmap_bdg_tap_dtor(struct netmap_adapter *na)
+{
+	struct nm_bridge *b = ((struct netmap_vp_adapter *)na)->tap_bdg;
+	struct nm_bpf_insn *f;
+
+	BDG_WLOCK(b);
+	b->bdg_tap = NULL;
+	f = b->bdg_tap_filter;
+	b->bdg_tap_filter = NULL;
+	BDG_WUNLOCK(b);
+	if (f)
+		free(f, M_DEVBUF);
+	if (b->bdg_active_ports == 0) {
+		ND("marking bridge %s as free", b->bdg_basename);
+		bzero(&b->bdg_ops, sizeof(b->bdg_ops));
+		NM_BNS_PUT(b);
+	}
+}
+
+/* get the tap of bridge b, creating it if needed. The tap is a
+ * virtual port that is not attached to the bridge: it does not
+ * appear in bdg_ports, and what it transmits is discarded.
+ * There is at most one tap per bridge.
+ */
+static int
+netmap_get_bdg_tap(struct nm_bridge *b, struct nmreq *nmr,
+	struct netmap_adapter **na, int create)
+{
+	struct netmap_vp_adapter *tap = b->bdg_tap;
+	int error;
+
+	if (tap) {
+		if (strcmp(tap->up.name, nmr->nr_name))
+			return EBUSY;
+		netmap_adapter_get(&tap->up);
+		*na = &tap->up;
+		return 0;
+	}
+	if (!create)
+		return ENXIO;
+	if (nmr->nr_cmd)
+		return EINVAL;
+
+	error = netmap_vp_create(nmr, NULL, &tap);
+	if (error)
+		return error;
+	tap->tap_bdg = b;
+	tap->up.na_flags |= NAF_BDG_TAP;
+	tap->up.nm_register = netmap_bdg_tap_reg;
+	tap->up.nm_dtor = netmap_bdg_tap_dtor;
+
+	BDG_WLOCK(b);
+	b->bdg_tap = tap;
+	BDG_WUNLOCK(b);
+	*na = &tap->up;
+	netmap_adapter_get(*na);
+	return 0;
+}
+
+/* NM_CFG_FILTER on a switch tap */
+int
+netmap_bdg_tap_filter(struct netmap_priv_d *priv, struct nm_filter_req *req)
+{
+	struct nm_bridge *b;
+	struct nm_bpf_insn *f, *old;
+	int error;
+
+	if (priv->np_nifp == NULL)
+		return ENXIO;
+	b = ((struct netmap_vp_adapter *)priv->np_na)->tap_bdg;
+	error = nm_filter_copyin(req, &f);
+	if (error)
+		return error;
+
+	BDG_WLOCK(b);
+	old = b->bdg_tap_filter;
+	b->bdg_tap_filter = f;
+	BDG_WUNLOCK(b);
+	if (old)
+		free(old, M_DEVBUF);
+	return 0;
+}
+
+
 /* Try to get a reference to a netmap adapter attached to a VALE switch.
  * If the adapter is found (or is created), this function returns 0, a
  * non NULL pointer is returned into *na, and the caller holds a
@@ -620,7 +740,8 @@ netmap_get_bdg_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 	/* first try to see if this is a bridge port. */
 	NMG_LOCK_ASSERT();
 	if (strncmp(nr_name, NM_NAME, sizeof(NM_NAME) - 1)) {
-		return 0;  /* no error, but no VALE prefix */
+		/* no error, but no VALE prefix */
+		return (nmr->nr_flags & NR_BDG_TAP) ? EINVAL : 0;
 	}
 
 	b = nm_find_bridge(nr_name, create);
@@ -630,6 +751,8 @@ netmap_get_bdg_na(struct nmreq *nmr, struct netmap_adapter **na, int create)
 	}
 	if (strlen(nr_name) < b->bdg_namelen) /* impossible */
 		panic("x");
+	if (nmr->nr_flags & NR_BDG_TAP)
+		return netmap_get_bdg_tap(b, nmr, na, create);
 
 	/* Now we are sure that name starts with the bridge's name,
 	 * lookup the port in the bridge. We need to scan the entire
@@ -1319,6 +1442,84 @@ nm_kr_lease(struct netmap_kring *k, u_int n, int is_rx)
 	return lease_idx;
 }
 
+/*
+ * Copy the n frames in ft (sent by port na) to the tap of bridge b,
+ * with the source and destination ports in the 'ptr' of the first
+ * slot of each frame. The tap ring is chosen by the source ring, and
+ * is filled under its lock, since several ports can flush at once.
+ * Frames that do not fit are dropped. Indirect buffers are user
+ * memory and cannot be read under the lock, so they are delivered
+ * with length 0 (and never match a filter).
+ */
+static void
+nm_bdg_tap(struct nm_bridge *b, struct nm_bdg_fwd *ft, u_int n,
+	struct netmap_vp_adapter *na, u_int ring_nr)
+{
+	struct netmap_vp_adapter *tap = b->bdg_tap;
+	struct nm_bpf_insn *filter = b->bdg_tap_filter;
+	struct netmap_kring *kring;
+	struct netmap_ring *ring;
+	u_int i, j, lim, space, buf_size, src_size, drops = 0;
+
+	if (unlikely(!nm_netmap_on(&tap->up)))
+		return;
+	kring = &tap->up.rx_rings[ring_nr % tap->up.num_rx_rings];
+	ring = kring->ring;
+	lim = kring->nkr_num_slots - 1;
+	buf_size = NETMAP_BUF_SIZE(&tap->up);
+	/* ft_len comes from the sender and is not bounded by its buffers */
+	src_size = NETMAP_BUF_SIZE(&na->up);
+	if (buf_size > src_size)
+		buf_size = src_size;
+
+	mtx_lock(&kring->q_lock);
+	if (kring->nkr_stopped) {
+		mtx_unlock(&kring->q_lock);
+		return;
+	}
+	j = kring->nr_hwtail;
+	space = nm_kr_space(kring, 1);
+	for (i = 0; i < n; i += ft[i].ft_frags) {
+		u_int cnt = ft[i].ft_frags, f;
+		uint64_t ptr = (na->bdg_port << 8) | ft[i].ft_port;
+
+		if (filter && ((ft[i].ft_flags & NS_INDIRECT) ||
+		    ft[i].ft_len == 0 || !nm_bpf_filter(filter,
+		    ft[i].ft_buf, ft[i].ft_len,
+		    ft[i].ft_len < src_size ? ft[i].ft_len : src_size)))
+			continue;
+		if (cnt > space) {
+			drops++;
+			continue;
+		}
+		space -= cnt;
+		for (f = 0; f < cnt; f++) {
+			struct nm_bdg_fwd *ft_p = &ft[i + f];
+			struct netmap_slot *slot = &ring->slot[j];
+			u_int len = ft_p->ft_len;
+
+			if (ft_p->ft_flags & NS_INDIRECT)
+				len = 0;
+			else if (len > buf_size)
+				len = buf_size;
+			memcpy(NMB(&tap->up, slot), ft_p->ft_buf, len);
+			slot->len = len;
+			slot->flags = (f + 1 < cnt) ? NS_MOREFRAG : 0;
+			slot->ptr = ptr;
+			j = nm_next(j, lim);
+		}
+	}
+	if (drops)
+		nm_kr_stats_drop(kring, NR_DROP_RING_FULL, drops);
+	if (j == kring->nr_hwtail) {
+		mtx_unlock(&kring->q_lock);
+		return;
+	}
+	kring->nr_hwtail = kring->nkr_hwlease = j;
+	mtx_unlock(&kring->q_lock);
+	tap->up.nm_notify(&tap->up, kring->ring_id, NR_RX, 0);
+}
+
 /*
  *
  * This flush routine supports only unicast and broadcast but a large
@@ -1332,6 +1533,7 @@ nm_bdg_flush(struct nm_bdg_fwd *ft, u_int n, struct netmap_vp_adapter *na,
 	uint16_t num_dsts = 0, *dsts;
 	struct nm_bridge *b = na->na_bdg;
 	u_int i, j, me = na->bdg_port;
+	u_int no_dst = 0;	/* packets without a destination */
 
 	/*
 	 * The work area (pointed by ft) is followed by an array of
@@ -1342,6 +1544,9 @@ nm_bdg_flush(struct nm_bdg_fwd *ft, u_int n, struct netmap_vp_adapter *na,
 	dst_ents = (struct nm_bdg_q *)(ft + NM_BDG_BATCH_MAX);
 	dsts = (uint16_t *)(dst_ents + NM_BDG_MAXPORTS * NM_BDG_MAXRINGS + 1);
 
+	if (NM_LAT_ON(&na->up))
+		nm_lat_record(&na->up, NM_LAT_BDG_BATCH, n);
+
 	/* first pass: find a destination for each packet in the batch */
 	for (i = 0; likely(i < n); i += ft[i].ft_frags) {
 		uint8_t dst_ring = ring_nr; /* default, same ring as origin */
@@ -1349,22 +1554,31 @@ nm_bdg_flush(struct nm_bdg_fwd *ft, u_int n, struct netmap_vp_adapter *na,
 		struct nm_bdg_q *d;
 
 		ND("slot %d frags %d", i, ft[i].ft_frags);
+		ft[i].ft_port = NM_BDG_NOPORT; /* for the tap */
 		/* Drop the packet if the virtio-net header is not into the first
 		   fragment nor at the very beginning of the second. */
-		if (unlikely(na->virt_hdr_len > ft[i].ft_len))
+		if (unlikely(na->virt_hdr_len > ft[i].ft_len)) {
+			no_dst++;
 			continue;
+		}
 		dst_port = b->bdg_ops.lookup(&ft[i], &dst_ring, na);
 		if (netmap_verbose > 255)
 			RD(5, "slot %d port %d -> %d", i, me, dst_port);
-		if (dst_port == NM_BDG_NOPORT)
+		if (dst_port == NM_BDG_NOPORT) {
+			no_dst++;
 			continue; /* this packet is identified to be dropped */
-		else if (unlikely(dst_port > NM_BDG_MAXPORTS))
+		} else if (unlikely(dst_port > NM_BDG_MAXPORTS)) {
+			no_dst++;
 			continue;
-		else if (dst_port == NM_BDG_BROADCAST)
+		} else if (dst_port == NM_BDG_BROADCAST)
 			dst_ring = 0; /* broadcasts always go to ring 0 */
 		else if (unlikely(dst_port == me ||
-		    !b->bdg_ports[dst_port]))
+		    !b->bdg_ports[dst_port])) {
+			no_dst++;
 			continue;
+		}
+
+		ft[i].ft_port = dst_port;
 
 		/* get a position in the scratch pad */
 		d_i = dst_port * NM_BDG_MAXRINGS + dst_ring;
@@ -1383,6 +1597,12 @@ nm_bdg_flush(struct nm_bdg_fwd *ft, u_int n, struct netmap_vp_adapter *na,
 		d->bq_len += ft[i].ft_frags;
 	}
 
+	if (no_dst)
+		nm_kr_stats_drop(&na->up.tx_rings[ring_nr], NR_DROP_NO_DST, no_dst);
+
+	if (b->bdg_tap)
+		nm_bdg_tap(b, ft, n, na, ring_nr);
+
 	/*
 	 * Broadcast traffic goes to ring 0 on all destinations.
 	 * So we need to add these rings to the list of ports to scan.
@@ -1590,6 +1810,10 @@ retry:
 		    int still_locked = 1;
 
 		    mtx_lock(&kring->q_lock);
+		    /* slots left undelivered, unless we are going to retry */
+		    if (needed > 0 && !virt_hdr_mismatch &&
+			    !(dst_na->retry && retry))
+			nm_kr_stats_drop(kring, NR_DROP_RING_FULL, needed);
 		    if (unlikely(howmany > 0)) {
 			/* not used all bufs. If i am the last one
 			 * i can recover the slots, otherwise must
@@ -1810,7 +2034,7 @@ netmap_vp_create(struct nmreq *nmr, struct ifnet *ifp, struct netmap_vp_adapter
 	 * So let's use 2 as default (when 0 is supplied)
 	 */
 	npipes = nmr->nr_arg1;
-	nm_bound_var(&npipes, 2, 1, NM_MAXPIPES, NULL);
+	nm_bound_var(&npipes, 2, 1, NM_BDG_MAXPIPES, NULL);
 	nmr->nr_arg1 = npipes;	/* write back */
 	/* validate extra bufs */
 	nm_bound_var(&nmr->nr_arg3, 0, 0,
@@ -1823,7 +2047,7 @@ netmap_vp_create(struct nmreq *nmr, struct ifnet *ifp, struct netmap_vp_adapter
         if (netmap_verbose)
 		D("max frame size %u", vpna->mfs);
 
-	na->na_flags |= NAF_BDG_MAYSLEEP | NAF_MEM_OWNER;
+	na->na_flags |= NAF_BDG_MAYSLEEP | NAF_MEM_OWNER | NAF_RESIZABLE;
 	na->nm_txsync = netmap_vp_txsync;
 	na->nm_rxsync = netmap_vp_rxsync;
 	na->nm_register = netmap_vp_reg;
@@ -1836,6 +2060,9 @@ netmap_vp_create(struct nmreq *nmr, struct ifnet *ifp, struct netmap_vp_adapter
 			nmr->nr_arg3, npipes, &error);
 	if (na->nm_mem == NULL)
 		goto err;
+#ifdef WITH_PIPES
+	na->na_pipe_space = npipes;
+#endif /* WITH_PIPES */
 	na->nm_bdg_attach = netmap_vp_bdg_attach;
 	/* other nmd fields are set in the common routine */
 	error = netmap_attach_common(na);
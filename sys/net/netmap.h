@@ -195,6 +195,14 @@ struct netmap_slot {
 	 * The 'len' field refers to the individual fragment.
 	 */
 
+#define	NS_MONITOR_TX	0x0040	/* frame seen on a tx ring */
+	/*
+	 * (monitor rings only) the frame was transmitted, not
+	 * received, by the monitored port. On monitor rings the
+	 * 'ptr' field holds the time the monitor got the frame,
+	 * in nanoseconds since the epoch.
+	 */
+
 #define	NS_PORT_SHIFT	8
 #define	NS_PORT_MASK	(0xff << NS_PORT_SHIFT)
 	/*
@@ -295,6 +303,47 @@ struct netmap_ring {
 	 */
 
 
+/*
+ * Per-ring statistics.
+ * The kernel keeps them in the shared memory region, right after
+ * the slots of each ring, so that any process which mapped the
+ * region can read them without system calls (see NETMAP_RING_STATS()).
+ * They are only written by the kernel and live on their own cache
+ * lines. packets, bytes and syncs are updated by the owner of the
+ * ring; notifies and drops can come from any context, and are
+ * updated atomically.
+ * Counters are cleared when the ring is created, and wrap around.
+ * Updates can be disabled with the dev.netmap.stats sysctl.
+ */
+enum {	NR_DROP_RING_FULL = 0,	/* no room in the destination ring */
+	NR_DROP_TOO_LONG,	/* packet larger than a netmap buffer */
+	NR_DROP_BACKLOG,	/* queue towards the ring over limit */
+	NR_DROP_NO_DST,		/* no destination for the packet */
+	NR_DROP_NOMEM,		/* memory allocation failure */
+	NR_DROP_BAD_SLOT,	/* invalid slot, e.g. bad indirect buffer */
+	NR_DROP_REASONS = 8
+};
+
+struct netmap_ring_stats {
+	uint64_t	packets;	/* tx: passed by userspace to the kernel
+					 * rx: passed by the kernel to userspace
+					 */
+	uint64_t	bytes;		/* same, in bytes */
+	uint64_t	syncs;		/* txsync/rxsync on the ring */
+	uint64_t	notifies;	/* wakeups issued for the ring */
+	uint64_t	drops[NR_DROP_REASONS]; /* dropped, by reason */
+} __attribute__((__aligned__(NM_CACHE_ALIGN)));
+
+/* offset of the statistics from a ring with _n slots */
+#define NETMAP_RING_STATS_OFS(_n)					\
+	((sizeof(struct netmap_ring) + (_n) * sizeof(struct netmap_slot) \
+	    + NM_CACHE_ALIGN - 1) & ~(size_t)(NM_CACHE_ALIGN - 1))
+
+#define NETMAP_RING_STATS(r)						\
+	((struct netmap_ring_stats *)(void *)((char *)(r) +		\
+	    NETMAP_RING_STATS_OFS((r)->num_slots)))
+
+
 /*
  * Netmap representation of an interface and its queue(s).
  * This is initialized by the kernel when binding a file
@@ -354,6 +403,11 @@ struct netmap_if {
  * NIOCREGIF takes an interface name within a struct nmre,
  *	and activates netmap mode on the interface (if possible).
  *
+ * NIOCSYNCV takes a struct nm_syncv and runs txsync and/or rxsync
+ *	on several netmap file descriptors (each one already bound
+ *	with NIOCREGIF) in a single system call. It can be issued on
+ *	any netmap file descriptor, and returns a readiness bitmap.
+ *
  * The argument to NIOCGINFO/NIOCREGIF overlays struct ifreq so we
  * can pass it down to other NIC-related ioctls.
  *
@@ -513,6 +567,75 @@ enum {	NR_REG_DEFAULT	= 0,	/* backward compat, should not be used. */
 /* monitor uses the NR_REG to select the rings to monitor */
 #define NR_MONITOR_TX	0x100
 #define NR_MONITOR_RX	0x200
+/* the monitor gets a copy of the first nr_arg1 bytes (0: all) of each
+ * frame in its own buffers, and leaves the monitored slots alone
+ */
+#define NR_MONITOR_COPY	0x4000
+/* tx frames go to the tx rings of the monitor, rx frames to the rx rings */
+#define NR_MONITOR_SPLIT	0x8000
+/* on pipe creation, make a group of nr_rx_rings slave rings */
+#define NR_PIPE_GROUP	0x400
+#define NR_PIPE_RR	0x800	/* the group is served round robin */
+#define NR_PIPE_TEE	0x1000	/* every slave gets all the packets */
+#define NR_PIPE_BLOCK	0x2000	/* tee: wait for slow slaves, no drops */
+/* bind to the tap of the VALE switch in nr_name (valeX:name), which
+ * receives a copy of all the frames forwarded by the switch
+ */
+#define NR_BDG_TAP	0x10000
+
+/*
+ * On the rx rings of a VALE tap, 'ptr' holds the switch ports (as in
+ * NETMAP_BDG_LIST) the frame came from and went to. The destination
+ * is NM_TAP_BROADCAST for broadcasts, and NM_TAP_NOPORT for frames
+ * the switch dropped.
+ */
+#define NM_TAP_SRC(ptr)		((uint8_t)((ptr) >> 8))
+#define NM_TAP_DST(ptr)		((uint8_t)(ptr))
+#define NM_TAP_BROADCAST	254
+#define NM_TAP_NOPORT		255
+
+
+/*
+ * struct nm_syncv is the argument of NIOCSYNCV.
+ *
+ * nv_reqs (in)	user pointer to an array of nv_count (at most
+ *		NM_SYNCV_MAX) struct nm_syncreq, one per file descriptor:
+ *
+ *	nsr_fd		a netmap file descriptor bound with NIOCREGIF;
+ *	nsr_flags	NR_SYNC_TX and/or NR_SYNC_RX, the sync to run;
+ *	nsr_first, nsr_last
+ *			optional subrange [first, last) of the rings
+ *			bound to nsr_fd, relative to the first bound ring.
+ *			nsr_last == 0 means all the bound rings;
+ *	nsr_error (out)	0 or the errno for this entry (EBADF, ENXIO,
+ *			EBUSY, ...). Errors on one entry do not stop
+ *			the processing of the others.
+ *
+ * nv_ready (out) bit i is set if, after the sync, entry i has at
+ *		least one tx ring with free slots or one rx ring with
+ *		new packets (only the directions in nsr_flags are
+ *		checked). nv_nready is the number of bits set.
+ *
+ * The ioctl itself only fails if the argument is invalid.
+ */
+#define NM_SYNCV_MAX	256
+struct nm_syncreq {
+	int32_t		nsr_fd;
+	uint16_t	nsr_flags;
+#define NR_SYNC_TX	0x1
+#define NR_SYNC_RX	0x2
+	uint16_t	nsr_error;	/* out */
+	uint16_t	nsr_first;
+	uint16_t	nsr_last;
+	uint32_t	nsr_spare;
+};
+
+struct nm_syncv {
+	uint32_t	nv_count;	/* entries in nv_reqs */
+	uint32_t	nv_nready;	/* out: bits set in nv_ready */
+	uint64_t	nv_reqs;	/* user pointer to nm_syncreq[] */
+	uint64_t	nv_ready[NM_SYNCV_MAX / 64]; /* out */
+};
 
 
 /*
@@ -526,6 +649,7 @@ enum {	NR_REG_DEFAULT	= 0,	/* backward compat, should not be used. */
 #define NIOCTXSYNC	_IO('i', 148) /* sync tx queues */
 #define NIOCRXSYNC	_IO('i', 149) /* sync rx queues */
 #define NIOCCONFIG	_IOWR('i',150, struct nm_ifreq) /* for ext. modules */
+#define NIOCSYNCV	_IOWR('i', 151, struct nm_syncv) /* multi-fd sync */
 #endif /* !NIOCREGIF */
 
 
@@ -553,4 +677,129 @@ struct nm_ifreq {
 	char data[NM_IFRDATA_LEN];
 };
 
+/*
+ * NIOCCONFIG requests with an empty nifr_name are handled by netmap
+ * itself instead of being passed to the VALE module. In this case
+ * data starts with a uint16_t command, followed by the command
+ * specific arguments.
+ */
+#define NM_CFG_LATENCY	1	/* read a latency histogram */
+#define NM_CFG_RING_RESIZE 2	/* change the size of some rings */
+#define NM_CFG_RSS	3	/* software rss of emulated ports */
+#define NM_CFG_FILTER	4	/* packet filter of a monitor */
+#define NM_CFG_SAMPLE	5	/* sampling policy of a monitor */
+
+/*
+ * NM_CFG_LATENCY: return one of the log2 histograms collected
+ * (when dev.netmap.latency is set) for port nlr_name, or for the
+ * port bound to the file descriptor if nlr_name is empty.
+ * Bucket i counts the samples v with 2^i <= v < 2^(i+1), the first
+ * bucket also counts 0 and the last one everything above.
+ * Durations are in CPU cycles, batches in packets.
+ */
+#define NM_LAT_BUCKETS	29
+enum {	NM_LAT_TXSYNC = 0,	/* txsync duration */
+	NM_LAT_RXSYNC,		/* rxsync duration */
+	NM_LAT_BDG_BATCH,	/* packets per nm_bdg_flush() */
+	NM_LAT_WAKEUP,		/* from nm_notify() to poll() */
+	NM_LAT_NUM
+};
+
+struct nm_lat_req {
+	uint16_t	nlr_cmd;	/* NM_CFG_LATENCY */
+	uint16_t	nlr_hist;	/* one of NM_LAT_* */
+	uint32_t	nlr_flags;
+#define NM_LAT_RESET	0x1		/* clear after reading */
+	char		nlr_name[IFNAMSIZ];
+	uint64_t	nlr_bucket[NM_LAT_BUCKETS];	/* out */
+};
+
+/*
+ * NM_CFG_RING_RESIZE: change the number of slots of the rings
+ * [nrr_first, nrr_last) (nrr_last == 0 means all) of the port bound
+ * to the file descriptor, in the directions selected by nrr_flags,
+ * without going through a new NIOCREGIF.
+ * Only the affected rings are stopped during the operation, and
+ * their content is discarded. Processes using the rings must not
+ * access them during the call, and must then re-read num_slots.
+ * The size must be between 2 and the number of slots the rings were
+ * created with, which is returned in nrr_max_slots.
+ * Currently supported on VALE ports.
+ */
+struct nm_resize_req {
+	uint16_t	nrr_cmd;	/* NM_CFG_RING_RESIZE */
+	uint16_t	nrr_flags;
+#define NR_RESIZE_TX	0x1
+#define NR_RESIZE_RX	0x2
+	uint16_t	nrr_first;
+	uint16_t	nrr_last;
+	uint32_t	nrr_slots;	/* in: new size, out: current size */
+	uint32_t	nrr_max_slots;	/* out */
+};
+
+/*
+ * NM_CFG_RSS: read, or set with NM_RSS_SET, the software receive side
+ * scaling parameters of the emulated port nrs_name, or of the port
+ * bound to the file descriptor if nrs_name is empty.
+ * When dev.netmap.generic_rss is set, emulated ports have at least
+ * dev.netmap.generic_rings rx rings, and each received packet goes to
+ * ring nrs_table[h % NM_RSS_TABLE_SIZE], where h is the Toeplitz hash
+ * (with key nrs_key) of the IPv4/IPv6 addresses and TCP/UDP ports.
+ * The default key makes the hash symmetric, so both directions of a
+ * flow use the same ring. The default table is round robin.
+ */
+#define NM_RSS_KEY_LEN		40
+#define NM_RSS_TABLE_SIZE	128
+struct nm_rss_req {
+	uint16_t	nrs_cmd;	/* NM_CFG_RSS */
+	uint16_t	nrs_flags;
+#define NM_RSS_SET	0x1		/* install key and table */
+	uint16_t	nrs_rings;	/* out: number of rx rings */
+	uint16_t	nrs_spare;
+	char		nrs_name[IFNAMSIZ];
+	uint8_t		nrs_key[NM_RSS_KEY_LEN];
+	uint8_t		nrs_table[NM_RSS_TABLE_SIZE];
+};
+
+/*
+ * NM_CFG_FILTER: install on the monitor bound to the file descriptor
+ * the classic BPF program of nfr_len instructions (at most
+ * NM_FILTER_MAXLEN) at user address nfr_prog, or remove the current
+ * one if nfr_len is 0. The instructions have the layout of struct
+ * bpf_insn (struct sock_filter on linux). The monitor only gets the
+ * frames the program accepts, and copy monitors copy at most the
+ * number of bytes it returns.
+ */
+#define NM_FILTER_MAXLEN	512
+struct nm_filter_req {
+	uint16_t	nfr_cmd;	/* NM_CFG_FILTER */
+	uint16_t	nfr_len;	/* instructions, 0 removes the filter */
+	uint32_t	nfr_spare;
+	uint64_t	nfr_prog;	/* user pointer to the program */
+};
+
+/*
+ * NM_CFG_SAMPLE: make the monitor bound to the file descriptor only
+ * take a sample of the frames of each monitored ring. The policy is
+ * applied before the filter and before any copy or swap:
+ * NM_SAMPLE_ALL takes every frame (the default), NM_SAMPLE_NTH one
+ * frame in nsr_arg, NM_SAMPLE_PROB each frame with probability
+ * nsr_arg / 2^32, and NM_SAMPLE_PPS at most nsr_arg frames per
+ * second, in bursts of at most nsr_burst frames (nsr_arg if 0).
+ * Frames left out are not counted as drops.
+ */
+enum {	NM_SAMPLE_ALL = 0,
+	NM_SAMPLE_NTH,
+	NM_SAMPLE_PROB,
+	NM_SAMPLE_PPS,
+};
+
+struct nm_sample_req {
+	uint16_t	nsr_cmd;	/* NM_CFG_SAMPLE */
+	uint16_t	nsr_policy;	/* one of NM_SAMPLE_* */
+	uint32_t	nsr_arg;
+	uint32_t	nsr_burst;
+	uint32_t	nsr_spare;
+};
+
 #endif /* _NET_NETMAP_H_ */